@@ -0,0 +1,503 @@
+#include "compactor.h"
+#include "condition_parser.h"
+#include "database.h"
+#include "date.h"
+#include "profile.h"
+#include "sharded_database.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "versioned_database.h"
+#include "wal.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Date as it was stored before the packed key: every comparison builds two
+// vectors, kept here only as the baseline for the measurements below.
+struct LegacyDate {
+  int year, month, day;
+};
+bool operator<(const LegacyDate &lhs, const LegacyDate &rhs) {
+  return vector<int>{lhs.year, lhs.month, lhs.day} <
+         vector<int>{rhs.year, rhs.month, rhs.day};
+}
+
+vector<Date> RandomDates(size_t count) {
+  mt19937 gen(42);
+  uniform_int_distribution<int> year(1900, 2100), month(1, 12), day(1, 31);
+  vector<Date> dates;
+  dates.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    dates.emplace_back(year(gen), month(gen), day(gen));
+  }
+  return dates;
+}
+
+template <class Key, class MakeKey>
+size_t MapLookups(const vector<Date> &dates, MakeKey make_key) {
+  map<Key, int> index;
+  for (const auto &date : dates) {
+    ++index[make_key(date)];
+  }
+  size_t found = 0;
+  for (int round = 0; round < 5; ++round) {
+    for (const auto &date : dates) {
+      found += index.count(make_key(date));
+    }
+  }
+  return found;
+}
+
+void BenchDateLookup() {
+  const auto dates = RandomDates(1'000'000);
+  size_t found = 0;
+  {
+    LOG_DURATION("map<LegacyDate> insert + 5M lookups");
+    found += MapLookups<LegacyDate>(dates, [](const Date &d) {
+      return LegacyDate{d.GetYear(), d.GetMonth(), d.GetDay()};
+    });
+  }
+  {
+    LOG_DURATION("map<Date> insert + 5M lookups");
+    found += MapLookups<Date>(dates, [](const Date &d) { return d; });
+  }
+  cerr << "(checksum " << found << ")" << endl;
+}
+
+void BenchDateText() {
+  const auto dates = RandomDates(1'000'000);
+  vector<string> texts;
+  texts.reserve(dates.size());
+  {
+    LOG_DURATION("WriteDate x1M");
+    char buffer[kMaxDateLength];
+    for (const auto &date : dates) {
+      texts.emplace_back(buffer, WriteDate(buffer, date));
+    }
+  }
+  int checksum = 0;
+  {
+    LOG_DURATION("ParseDate(string_view) x1M");
+    for (const auto &text : texts) {
+      checksum += ParseDate(string_view(text)).GetDay();
+    }
+  }
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+Database MakeDatabase(int dates, int events_per_date) {
+  Database db;
+  for (int i = 0; i < dates; ++i) {
+    const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+    for (int j = 0; j < events_per_date; ++j) {
+      db.Add(date, "event " + to_string((i + j) % 100));
+    }
+  }
+  return db;
+}
+
+void BenchPredicate() {
+  const int kDates = 200'000, kEventsPerDate = 5;
+  const auto db = MakeDatabase(kDates, kEventsPerDate);
+  cerr << "scanning " << kDates * kEventsPerDate << " events per FindIf"
+       << endl;
+  const string text = R"(event == "event 3" OR event == "event 7")";
+  istringstream is(text);
+  const auto query = ParseQuery(is);
+  const auto condition = query.condition;
+  size_t found = 0;
+  {
+    LOG_DURATION("FindIf(std::function) x10");
+    const function<bool(const Date &, const string &)> predicate =
+        [condition](const Date &date, const string &event) {
+          return condition->Evaluate(date, event);
+        };
+    for (int i = 0; i < 10; ++i) {
+      found += db.FindIf(predicate).size();
+    }
+  }
+  {
+    LOG_DURATION("FindIf(lambda) x10");
+    const string first = "event 3", second = "event 7";
+    for (int i = 0; i < 10; ++i) {
+      found += db.FindIf([&](const Date &date, const string &event) {
+                   return event == first || event == second;
+                 }).size();
+    }
+  }
+  {
+    LOG_DURATION("FindIf(Query) x10");
+    for (int i = 0; i < 10; ++i) {
+      found += db.FindIf(query).size();
+    }
+  }
+  cerr << "(checksum " << found << ")" << endl;
+}
+
+void BenchSnapshot() {
+  const int kDates = 200'000, kEventsPerDate = 5;
+  const string path = "bench_snapshot.bin";
+  size_t checksum = 0;
+  {
+    LOG_DURATION("Add x1M + Save");
+    const auto db = MakeDatabase(kDates, kEventsPerDate);
+    db.Save(path);
+  }
+  {
+    LOG_DURATION("Load 1M events");
+    Database db;
+    db.Load(path);
+    checksum += db.Last(Date::Max()).size();
+  }
+  {
+    LOG_DURATION("Open 1M events + Last");
+    Database db;
+    db.Open(path);
+    checksum += db.Last(Date::Max()).size();
+  }
+  remove(path.c_str());
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+void BenchStartup() {
+  const int kDates = 800'000, kEventsPerDate = 5;
+  const string path = "bench_startup.bin";
+  MakeDatabase(kDates, kEventsPerDate).Save(path);
+  auto per_second = [](size_t events, chrono::steady_clock::duration took) {
+    return static_cast<uint64_t>(
+        events / chrono::duration<double>(took).count());
+  };
+  size_t checksum = 0;
+  {
+    const auto start = chrono::steady_clock::now();
+    Database db;
+    db.Load(path);
+    checksum += db.Last(Date::Max()).size();
+    cerr << "Load 4M events on " << GetThreadPool().GetConcurrency()
+         << " threads: "
+         << per_second(kDates * kEventsPerDate,
+                       chrono::steady_clock::now() - start)
+         << " events/s" << endl;
+  }
+  // Checking the chunks is the part that scales with the threads.
+  const vector<char> data = ReadFile(path);
+  const SnapshotView view =
+      ParseSnapshot(data.data(), data.size(), SnapshotCheck::Dictionary);
+  for (size_t threads : {1, 2, 4, 8}) {
+    ThreadPool pool(threads - 1);
+    const auto start = chrono::steady_clock::now();
+    pool.ParallelFor(view.chunk_count, [&view](size_t chunk) {
+      VerifySnapshotChunk(view, chunk);
+    });
+    cerr << "Verify " << view.chunk_count << " chunks on " << threads
+         << " threads: "
+         << per_second(view.event_count, chrono::steady_clock::now() - start)
+         << " events/s" << endl;
+  }
+  remove(path.c_str());
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+void BenchCompression() {
+  const int kDates = 800'000, kEventsPerDate = 5;
+  const string path = "bench_compression.bin";
+  const auto db = MakeDatabase(kDates, kEventsPerDate);
+  size_t checksum = 0, plain_size = 0;
+  for (auto encoding :
+       {SnapshotEncoding::Plain, SnapshotEncoding::Compressed}) {
+    const string name =
+        encoding == SnapshotEncoding::Plain ? "plain" : "compressed";
+    db.Save(path, encoding);
+    const size_t size = ReadFile(path).size();
+    plain_size = plain_size == 0 ? size : plain_size;
+    const auto start = chrono::steady_clock::now();
+    Database loaded;
+    loaded.Load(path);
+    checksum += loaded.Last(Date::Max()).size();
+    const double took =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << "Load 4M events " << name << ": " << size << " bytes (x"
+         << static_cast<double>(plain_size) / size << " smaller), "
+         << static_cast<uint64_t>(kDates * kEventsPerDate / took)
+         << " events/s" << endl;
+  }
+  remove(path.c_str());
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+void BenchShardedReads() {
+  const int kDates = 200'000, kEventsPerDate = 5, kQueries = 4000;
+  ShardedDatabase db(8, {{1900, 1, 1}, {2437, 12, 31}});
+  for (int i = 0; i < kDates; ++i) {
+    const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+    for (int j = 0; j < kEventsPerDate; ++j) {
+      db.Add(date, "event " + to_string((i + j) % 100));
+    }
+  }
+  vector<Query> queries;
+  mt19937 random(7);
+  for (int i = 0; i < kQueries; ++i) {
+    const string year = to_string(1900 + random() % 537);
+    queries.push_back(ParseQuery("date >= " + year + "-01-01 AND date < " +
+                                 year + R"(-03-01 AND event != "event 7")"));
+  }
+  size_t checksum = 0;
+  for (size_t threads : {1, 2, 4, 8}) {
+    const auto start = chrono::steady_clock::now();
+    vector<thread> readers;
+    vector<size_t> found(threads);
+    for (size_t t = 0; t < threads; ++t) {
+      readers.emplace_back([&, t] {
+        for (size_t i = t; i < queries.size(); i += threads) {
+          found[t] +=
+              db.ForEachIf(queries[i], [](const Date &, string_view) {});
+        }
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+    const double took =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (size_t count : found) {
+      checksum += count;
+    }
+    cerr << "Find on 8 shards from " << threads << " threads: "
+         << static_cast<uint64_t>(queries.size() / took) << " queries/s"
+         << endl;
+  }
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+// A condition pushdown can't narrow, answered on one thread through
+// ForEachIf and on the thread pool through FindIf.
+void BenchParallelFindIf() {
+  const int kDates = 100'000, kEventsPerDate = 10, kRuns = 5;
+  Database db;
+  for (int i = 0; i < kDates; ++i) {
+    const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+    // Every tenth date is ten times as dense.
+    const int events = i % 10 == 0 ? 10 * kEventsPerDate : kEventsPerDate;
+    for (int j = 0; j < events; ++j) {
+      db.Add(date, "event " + to_string((i + j) % 100));
+    }
+  }
+  const Query query =
+      ParseQuery(R"(event != "event 7" OR date > 1900-01-01)");
+  size_t checksum = 0;
+  const auto time = [&](const char *name, auto find) {
+    const auto start = chrono::steady_clock::now();
+    for (int run = 0; run < kRuns; ++run) {
+      checksum += find().size();
+    }
+    const double took =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << name << ": " << took * 1000 / kRuns << " ms per query" << endl;
+  };
+  time("FindIf, one thread", [&] {
+    vector<string> entries;
+    db.ForEachIf(query, [&entries](const Date &date, string_view event) {
+      entries.push_back(date.getDate() + " " + string(event));
+    });
+    return entries;
+  });
+  time("FindIf, thread pool", [&] { return db.FindIf(query); });
+  cerr << "(" << GetThreadPool().GetConcurrency() << " threads, checksum "
+       << checksum << ")" << endl;
+}
+
+// Removes a third of every date's events, through the predicate overload on
+// one thread and through a query on the thread pool.
+void BenchParallelRemoveIf() {
+  const int kDates = 100'000, kEventsPerDate = 10;
+  const auto fill = [&](Database &db) {
+    for (int i = 0; i < kDates; ++i) {
+      const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+      for (int j = 0; j < kEventsPerDate; ++j) {
+        db.Add(date, "event " + to_string((i + j) % 30));
+      }
+    }
+  };
+  const auto time = [](const char *name, auto remove) {
+    const auto start = chrono::steady_clock::now();
+    const int removed = remove();
+    const double took =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << name << ": " << took * 1000 << " ms for " << removed
+         << " entries" << endl;
+  };
+  Database serial, parallel;
+  fill(serial);
+  fill(parallel);
+  time("RemoveIf, one thread", [&] {
+    return serial.RemoveIf([](const Date &, const string &event) {
+      return event < "event 2";
+    });
+  });
+  time("RemoveIf, thread pool",
+       [&] { return parallel.RemoveIf(ParseQuery(R"(event < "event 2")")); });
+}
+
+// Adds from one thread while another keeps printing everything: what
+// matters is how long the slowest Add waited.
+template <typename DB>
+void AddBesidePrint(const string &name, DB &db, int dates) {
+  atomic<bool> done{false};
+  thread reader([&] {
+    while (!done) {
+      ostringstream out;
+      db.Print(out);
+    }
+  });
+  chrono::steady_clock::duration slowest{0};
+  const auto start = chrono::steady_clock::now();
+  for (int i = 0; i < dates; ++i) {
+    const auto add_start = chrono::steady_clock::now();
+    db.Add({2500 + i / 372, 1 + i / 31 % 12, 1 + i % 31}, "new");
+    slowest = max(slowest, chrono::steady_clock::now() - add_start);
+  }
+  const auto took = chrono::steady_clock::now() - start;
+  done = true;
+  reader.join();
+  cerr << "Add x" << dates << " beside a Print loop, " << name << ": "
+       << chrono::duration_cast<chrono::milliseconds>(took).count()
+       << " ms, slowest Add "
+       << chrono::duration_cast<chrono::microseconds>(slowest).count()
+       << " us" << endl;
+}
+
+void BenchVersioned() {
+  const int kDates = 200'000, kEventsPerDate = 5, kAdds = 20'000;
+  {
+    VersionedDatabase db;
+    {
+      LOG_DURATION("VersionedDatabase Add x1M");
+      for (int i = 0; i < kDates; ++i) {
+        const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+        for (int j = 0; j < kEventsPerDate; ++j) {
+          db.Add(date, "event " + to_string((i + j) % 100));
+        }
+      }
+    }
+    LOG_DURATION("VersionedDatabase Print 1M");
+    ostringstream out;
+    db.Print(out);
+  }
+  ShardedDatabase locked(1, {Date::Min(), Date::Max()});
+  VersionedDatabase versioned;
+  for (int i = 0; i < kDates / 4; ++i) {
+    const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+    for (int j = 0; j < kEventsPerDate; ++j) {
+      locked.Add(date, "event " + to_string((i + j) % 100));
+      versioned.Add(date, "event " + to_string((i + j) % 100));
+    }
+  }
+  AddBesidePrint("reader-writer lock", locked, kAdds);
+  AddBesidePrint("versioned", versioned, kAdds);
+}
+
+void BenchWriteAheadLog() {
+  const int kDates = 200'000, kEventsPerDate = 5;
+  const string path = "bench_wal.log";
+  size_t checksum = 0;
+  for (size_t group : {size_t{64}, size_t{1024}}) {
+    remove(path.c_str());
+    LOG_DURATION("Add x1M, log synced every " + to_string(group));
+    Database db;
+    WriteAheadLog log(path, 0, {group, chrono::milliseconds(10)});
+    db.SetLog(&log);
+    for (int i = 0; i < kDates; ++i) {
+      const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+      for (int j = 0; j < kEventsPerDate; ++j) {
+        db.Add(date, "event " + to_string((i + j) % 100));
+      }
+    }
+    checksum += log.GetSyncCount();
+  }
+  {
+    LOG_DURATION("Recover 1M records");
+    Database db;
+    checksum += db.Recover(path);
+  }
+  {
+    remove(path.c_str());
+    CompactionMetrics metrics;
+    {
+      LOG_DURATION("Add x1M, log compacted every 8 MiB");
+      Database db;
+      WriteAheadLog log(path, 0, {1024, chrono::milliseconds(10)});
+      Compactor compactor(log, {8 << 20, chrono::seconds(60)});
+      db.SetLog(&log);
+      db.SetCompactor(&compactor);
+      for (int i = 0; i < kDates; ++i) {
+        const Date date{1900 + i / 372, 1 + i / 31 % 12, 1 + i % 31};
+        for (int j = 0; j < kEventsPerDate; ++j) {
+          db.Add(date, "event " + to_string((i + j) % 100));
+        }
+      }
+      compactor.Wait();
+      metrics = compactor.GetMetrics();
+    }
+    cerr << metrics.compactions << " compactions, last one "
+         << metrics.last_capture.count() << " us capture + "
+         << metrics.last_write.count() << " us write in the background"
+         << endl;
+    remove(WriteAheadLog::CheckpointPath(path).c_str());
+  }
+  remove(path.c_str());
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+void BenchBulkLoad() {
+  const int kEntries = 1'000'000;
+  const auto dates = RandomDates(kEntries);
+  vector<string> names;
+  for (int i = 0; i < kEntries; ++i) {
+    names.push_back("event " + to_string(i % 1000));
+  }
+  vector<pair<Date, string_view>> entries;
+  for (int i = 0; i < kEntries; ++i) {
+    entries.emplace_back(dates[i], names[i]);
+  }
+  size_t checksum = 0;
+  {
+    LOG_DURATION("Add x1M in random date order");
+    Database db;
+    for (const auto &[date, event] : entries) {
+      db.Add(date, event);
+    }
+    checksum += db.Last(Date::Max()).size();
+  }
+  {
+    LOG_DURATION("BulkLoad 1M in random date order");
+    Database db;
+    db.BulkLoad(entries);
+    checksum += db.Last(Date::Max()).size();
+  }
+  cerr << "(checksum " << checksum << ")" << endl;
+}
+
+int main() {
+  BenchDateLookup();
+  BenchDateText();
+  BenchPredicate();
+  BenchSnapshot();
+  BenchStartup();
+  BenchCompression();
+  BenchShardedReads();
+  BenchParallelFindIf();
+  BenchParallelRemoveIf();
+  BenchVersioned();
+  BenchWriteAheadLog();
+  BenchBulkLoad();
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include "compactor.h"
+#include <cstdio>
+#include <exception>
+
+using namespace std;
+
+Compactor::Compactor(WriteAheadLog &log, CompactionPolicy policy)
+    : log_(log), policy_(policy), last_start_(chrono::steady_clock::now()),
+      worker_([this] { Work(); }) {}
+
+Compactor::~Compactor() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+  worker_.join();
+}
+
+bool Compactor::Due() const {
+  const uint64_t size = log_.GetSize();
+  if (size == 0 || running_ || failed_) {
+    return false;
+  }
+  return size >= policy_.max_log_bytes ||
+         chrono::steady_clock::now() - last_start_ >= policy_.interval;
+}
+
+void Compactor::Start(SnapshotColumns columns,
+                      chrono::microseconds capture) {
+  Wait();
+  log_.Rotate();
+  last_start_ = chrono::steady_clock::now();
+  running_ = true;
+  {
+    lock_guard<mutex> lock(mutex_);
+    metrics_.last_capture = capture;
+    job_ = move(columns);
+  }
+  changed_.notify_all();
+}
+
+void Compactor::Wait() {
+  unique_lock<mutex> lock(mutex_);
+  changed_.wait(lock, [this] { return !running_; });
+}
+
+CompactionMetrics Compactor::GetMetrics() const {
+  lock_guard<mutex> lock(mutex_);
+  return metrics_;
+}
+
+void Compactor::Work() {
+  unique_lock<mutex> lock(mutex_);
+  while (true) {
+    changed_.wait(lock, [this] { return stop_ || job_; });
+    if (!job_) {
+      return;
+    }
+    const SnapshotColumns columns = move(*job_);
+    job_.reset();
+    lock.unlock();
+
+    const auto start = chrono::steady_clock::now();
+    string error;
+    try {
+      // WriteSnapshot syncs the directory, so the snapshot's rename is on
+      // disk before the rotated records are removed.
+      WriteSnapshot(WriteAheadLog::CheckpointPath(log_.GetPath()), columns);
+      const string rotated = WriteAheadLog::RotatedPath(log_.GetPath());
+      remove(rotated.c_str());
+      SyncDirectory(rotated);
+    } catch (const exception &e) {
+      // The rotated log stays, so recovery still sees every record.
+      error = e.what();
+    }
+    const auto took = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - start);
+
+    lock.lock();
+    if (error.empty()) {
+      ++metrics_.compactions;
+      metrics_.last_write = took;
+      metrics_.total_write += took;
+      metrics_.last_snapshot_events = columns.events.size();
+    } else {
+      metrics_.error = error;
+      failed_ = true;
+    }
+    running_ = false;
+    changed_.notify_all();
+  }
+}
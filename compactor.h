@@ -0,0 +1,71 @@
+#pragma once
+#include "snapshot.h"
+#include "wal.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+struct CompactionPolicy {
+  // Compact once the log holds this many bytes...
+  uint64_t max_log_bytes = uint64_t{64} << 20;
+  // ...or this long after the previous compaction, if anything was logged.
+  std::chrono::seconds interval{60};
+};
+
+struct CompactionMetrics {
+  uint64_t compactions = 0;
+  // How long the database's thread spent capturing the last snapshot, and
+  // how long the background thread then took to write it.
+  std::chrono::microseconds last_capture{0};
+  std::chrono::microseconds last_write{0};
+  std::chrono::microseconds total_write{0};
+  uint64_t last_snapshot_events = 0;
+  // Set if a compaction failed; no more are started after that.
+  std::string error;
+};
+
+// Turns a write-ahead log into snapshots on a background thread. The
+// database captures its columns at a log position; the compactor rotates
+// the log at that position, writes the snapshot while new records go to
+// the fresh log, and then drops the rotated records.
+class Compactor {
+public:
+  explicit Compactor(WriteAheadLog &log, CompactionPolicy policy = {});
+  // Finishes the running compaction.
+  ~Compactor();
+  Compactor(const Compactor &) = delete;
+  Compactor &operator=(const Compactor &) = delete;
+
+  // Whether the policy asks for a compaction and none is running. Called
+  // on the database's thread, like Start.
+  bool Due() const;
+  // `columns` must hold exactly the records appended to the log so far.
+  void Start(SnapshotColumns columns, std::chrono::microseconds capture);
+  // Blocks until no compaction is running.
+  void Wait();
+
+  CompactionMetrics GetMetrics() const;
+  uint64_t GetLogSize() const { return log_.GetSize(); }
+
+private:
+  void Work();
+
+  WriteAheadLog &log_;
+  const CompactionPolicy policy_;
+  std::chrono::steady_clock::time_point last_start_;
+  std::atomic<bool> running_{false};
+  std::atomic<bool> failed_{false};
+
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  std::optional<SnapshotColumns> job_;
+  bool stop_ = false;
+  CompactionMetrics metrics_;
+  // Last, so that it starts after everything it uses.
+  std::thread worker_;
+};
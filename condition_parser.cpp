@@ -1,7 +1,7 @@
 #include "condition_parser.h"
 #include "token.h"
 
-#include <map>
+#include <iterator>
 using namespace std;
 
 template <class It> shared_ptr<Node> ParseComparison(It &current, It end) {
@@ -9,7 +9,7 @@ template <class It> shared_ptr<Node> ParseComparison(It &current, It end) {
     throw logic_error("Expected column name: date or event");
   }
 
-  Token &column = *current;
+  const Token column = *current;
   if (column.type != TokenType::COLUMN) {
     throw logic_error("Expected column name: date or event");
   }
@@ -19,7 +19,7 @@ template <class It> shared_ptr<Node> ParseComparison(It &current, It end) {
     throw logic_error("Expected comparison operation");
   }
 
-  Token &op = *current;
+  const Token op = *current;
   if (op.type != TokenType::COMPARE_OP) {
     throw logic_error("Expected comparison operation");
   }
@@ -43,17 +43,16 @@ template <class It> shared_ptr<Node> ParseComparison(It &current, It end) {
   } else if (op.value == "!=") {
     cmp = Comparison::NotEqual;
   } else {
-    throw logic_error("Unknown comparison token: " + op.value);
+    throw logic_error("Unknown comparison token: " + string(op.value));
   }
 
-  const string &value = current->value;
+  const string_view value = current->value;
   ++current;
 
   if (column.value == "date") {
-    istringstream is(value);
-    return make_shared<DateComparisonNode>(cmp, ParseDate(is));
+    return make_shared<DateComparisonNode>(cmp, ParseDate(value));
   } else {
-    return make_shared<EventComparisonNode>(cmp, value);
+    return make_shared<EventComparisonNode>(cmp, string(value));
   }
 }
 
@@ -76,9 +75,6 @@ shared_ptr<Node> ParseExpression(It &current, It end, unsigned precedence) {
     left = ParseComparison(current, end);
   }
 
-  const map<LogicalOperation, unsigned> precedences = {
-      {LogicalOperation::Or, 1}, {LogicalOperation::And, 2}};
-
   while (current != end && current->type != TokenType::PAREN_RIGHT) {
     if (current->type != TokenType::LOGICAL_OP) {
       throw logic_error("Expected logic operation");
@@ -86,7 +82,8 @@ shared_ptr<Node> ParseExpression(It &current, It end, unsigned precedence) {
 
     const auto logical_operation =
         current->value == "AND" ? LogicalOperation::And : LogicalOperation::Or;
-    const auto current_precedence = precedences.at(logical_operation);
+    const unsigned current_precedence =
+        logical_operation == LogicalOperation::And ? 2u : 1u;
     if (current_precedence <= precedence) {
       break;
     }
@@ -101,17 +98,102 @@ shared_ptr<Node> ParseExpression(It &current, It end, unsigned precedence) {
   return left;
 }
 
-shared_ptr<Node> ParseCondition(istream &is) {
-  auto tokens = Tokenize(is);
-  auto current = tokens.begin();
-  auto top_node = ParseExpression(current, tokens.end(), 0u);
+shared_ptr<Node> ParseCondition(string_view text) {
+  TokenIterator current(text);
+  auto top_node = ParseExpression(current, TokenIterator(), 0u);
 
   if (!top_node) {
     top_node = make_shared<EmptyNode>();
   }
 
-  if (current != tokens.end()) {
+  if (current != TokenIterator()) {
     throw logic_error("Unexpected tokens after condition");
   }
   return top_node;
-}
\ No newline at end of file
+}
+
+namespace {
+// Reads the rest of the stream, leaving it failed at end like the extraction
+// loop that used to tokenize from it.
+string ReadRest(istream &is) {
+  string text;
+  if (is) {
+    text.assign(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+  }
+  is.setstate(ios_base::eofbit | ios_base::failbit);
+  return text;
+}
+} // namespace
+
+shared_ptr<Node> ParseCondition(istream &is) {
+  return ParseCondition(string_view(ReadRest(is)));
+}
+
+DateRange ExtractDateRange(const Node &node) {
+  DateRange range;
+  if (auto date_node = dynamic_cast<const DateComparisonNode *>(&node)) {
+    const int32_t key = date_node->GetDate().GetKey();
+    switch (date_node->GetComparison()) {
+    case Comparison::Less:
+      range.last = Date::FromKey(key - 1);
+      break;
+    case Comparison::LessOrEqual:
+      range.last = Date::FromKey(key);
+      break;
+    case Comparison::Greater:
+      range.first = Date::FromKey(key + 1);
+      break;
+    case Comparison::GreaterOrEqual:
+      range.first = Date::FromKey(key);
+      break;
+    case Comparison::Equal:
+      range.first = range.last = Date::FromKey(key);
+      break;
+    case Comparison::NotEqual:
+      break;
+    }
+  } else if (auto logical_node =
+                 dynamic_cast<const LogicalOperationNode *>(&node)) {
+    const auto left = ExtractDateRange(logical_node->GetLeft());
+    const auto right = ExtractDateRange(logical_node->GetRight());
+    if (logical_node->GetOperation() == LogicalOperation::And) {
+      range.first = max(left.first, right.first);
+      range.last = min(left.last, right.last);
+    } else if (left.Empty()) {
+      range = right;
+    } else if (right.Empty()) {
+      range = left;
+    } else {
+      range.first = min(left.first, right.first);
+      range.last = max(left.last, right.last);
+    }
+  }
+  return range;
+}
+
+optional<string> ExtractEventEquality(const Node &node) {
+  if (auto event_node = dynamic_cast<const EventComparisonNode *>(&node)) {
+    if (event_node->GetComparison() == Comparison::Equal) {
+      return event_node->GetValue();
+    }
+  } else if (auto logical_node =
+                 dynamic_cast<const LogicalOperationNode *>(&node)) {
+    if (logical_node->GetOperation() == LogicalOperation::And) {
+      auto left = ExtractEventEquality(logical_node->GetLeft());
+      return left ? left : ExtractEventEquality(logical_node->GetRight());
+    }
+  }
+  return nullopt;
+}
+
+Query ParseQuery(istream &is) { return ParseQuery(string_view(ReadRest(is))); }
+
+Query ParseQuery(string_view text) {
+  Query query;
+  query.condition = ParseCondition(text);
+  query.program = ConditionProgram::Compile(*query.condition);
+  query.dates = ExtractDateRange(*query.condition);
+  query.event = ExtractEventEquality(*query.condition);
+  query.text = text;
+  return query;
+}
@@ -2,11 +2,25 @@
 
 #include "date.h"
 #include "node.h"
+#include "query.h"
 
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <string_view>
 using namespace std;
 
+// Parses the condition in `text`; the only allocations are the nodes.
+shared_ptr<Node> ParseCondition(string_view text);
+// Parses the rest of the stream as a condition.
 shared_ptr<Node> ParseCondition(istream &is);
+// Parses a condition and plans how to scan for it.
+Query ParseQuery(string_view text);
+Query ParseQuery(istream &is);
+
+// Smallest range holding every date the condition can accept.
+DateRange ExtractDateRange(const Node &node);
+// The value of an `event == value` term of the top-level conjunction.
+optional<string> ExtractEventEquality(const Node &node);
 
 void TestParseCondition();
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "condition_program.h"
+
+ConditionProgram ConditionProgram::Compile(const Node &node) {
+  ConditionProgram program;
+  program.Emit(node);
+  if (program.code_.empty()) {
+    program.code_.push_back({OpCode::True, 0, 0});
+  }
+  return program;
+}
+
+void ConditionProgram::Emit(const Node &node) {
+  if (auto date_node = dynamic_cast<const DateComparisonNode *>(&node)) {
+    const auto op = static_cast<int>(OpCode::DateLess) +
+                    static_cast<int>(date_node->GetComparison());
+    code_.push_back(
+        {static_cast<OpCode>(op), 0, date_node->GetDate().GetKey()});
+  } else if (auto event_node =
+                 dynamic_cast<const EventComparisonNode *>(&node)) {
+    const auto op = static_cast<int>(OpCode::EventLess) +
+                    static_cast<int>(event_node->GetComparison());
+    code_.push_back({static_cast<OpCode>(op),
+                     static_cast<uint32_t>(literals_.size()), kNoEvent});
+    literals_.push_back(event_node->GetValue());
+  } else if (auto logical_node =
+                 dynamic_cast<const LogicalOperationNode *>(&node)) {
+    Emit(logical_node->GetLeft());
+    const size_t jump = code_.size();
+    code_.push_back({logical_node->GetOperation() == LogicalOperation::And
+                         ? OpCode::JumpIfFalse
+                         : OpCode::JumpIfTrue,
+                     0, 0});
+    Emit(logical_node->GetRight());
+    code_[jump].operand = code_.size();
+  } else {
+    code_.push_back({OpCode::True, 0, 0});
+  }
+}
+
+void ConditionProgram::Bind(EventDictionary &dictionary) {
+  for (auto &instruction : code_) {
+    if (instruction.op < OpCode::EventLess ||
+        OpCode::EventNotEqual < instruction.op) {
+      continue;
+    }
+    const std::string &value = literals_[instruction.literal];
+    switch (instruction.op) {
+    case OpCode::EventEqual:
+    case OpCode::EventNotEqual:
+      instruction.operand = dictionary.Find(value);
+      break;
+    case OpCode::EventLess:
+    case OpCode::EventGreaterOrEqual:
+      dictionary.SortRanks();
+      ranks_ = dictionary.GetRanks();
+      instruction.operand = dictionary.RankLowerBound(value);
+      break;
+    case OpCode::EventLessOrEqual:
+    case OpCode::EventGreater:
+      dictionary.SortRanks();
+      ranks_ = dictionary.GetRanks();
+      instruction.operand = dictionary.RankUpperBound(value);
+      break;
+    default:
+      break;
+    }
+  }
+  bound_ = true;
+}
+
+void ConditionProgram::Bind(
+    const EventDictionary &dictionary,
+    std::shared_ptr<const EventDictionary::RankTable> ranks) {
+  for (auto &instruction : code_) {
+    if (instruction.op < OpCode::EventLess ||
+        OpCode::EventNotEqual < instruction.op) {
+      continue;
+    }
+    const std::string &value = literals_[instruction.literal];
+    switch (instruction.op) {
+    case OpCode::EventEqual:
+    case OpCode::EventNotEqual:
+      instruction.operand = dictionary.Find(*ranks, value);
+      break;
+    case OpCode::EventLess:
+    case OpCode::EventGreaterOrEqual:
+      instruction.operand = dictionary.RankLowerBound(*ranks, value);
+      break;
+    case OpCode::EventLessOrEqual:
+    case OpCode::EventGreater:
+      instruction.operand = dictionary.RankUpperBound(*ranks, value);
+      break;
+    default:
+      break;
+    }
+  }
+  ranks_ = std::move(ranks);
+  bound_ = true;
+}
+
+DateVerdict ConditionProgram::EvaluateDate(const Date &date) const {
+  size_t pc = 0;
+  return EvaluateDate(date.GetKey(), pc, code_.size());
+}
+
+DateVerdict ConditionProgram::EvaluateDate(int64_t key, size_t &pc,
+                                           size_t end) const {
+  auto verdict = [](bool accepted) {
+    return accepted ? DateVerdict::Accept : DateVerdict::Reject;
+  };
+  const Instruction &first = code_[pc++];
+  const int64_t operand = first.operand;
+  DateVerdict result = DateVerdict::DependsOnEvent;
+  switch (first.op) {
+  case OpCode::True:
+    result = DateVerdict::Accept;
+    break;
+  case OpCode::DateLess:
+    result = verdict(key < operand);
+    break;
+  case OpCode::DateLessOrEqual:
+    result = verdict(key <= operand);
+    break;
+  case OpCode::DateGreater:
+    result = verdict(key > operand);
+    break;
+  case OpCode::DateGreaterOrEqual:
+    result = verdict(key >= operand);
+    break;
+  case OpCode::DateEqual:
+    result = verdict(key == operand);
+    break;
+  case OpCode::DateNotEqual:
+    result = verdict(key != operand);
+    break;
+  // A value that was never interned can't equal any stored event.
+  case OpCode::EventEqual:
+    if (bound_ && operand == kNoEvent) {
+      result = DateVerdict::Reject;
+    }
+    break;
+  case OpCode::EventNotEqual:
+    if (bound_ && operand == kNoEvent) {
+      result = DateVerdict::Accept;
+    }
+    break;
+  default:
+    break;
+  }
+  while (pc < end) {
+    // The verdict that settles the operation on its own: Reject for AND,
+    // Accept for OR.
+    const Instruction &jump = code_[pc++];
+    const DateVerdict decisive = jump.op == OpCode::JumpIfFalse
+                                     ? DateVerdict::Reject
+                                     : DateVerdict::Accept;
+    const size_t right_end = jump.operand;
+    if (result == decisive) {
+      pc = right_end;
+      continue;
+    }
+    const DateVerdict right = EvaluateDate(key, pc, right_end);
+    if (right == decisive) {
+      result = decisive;
+    } else if (right == DateVerdict::DependsOnEvent) {
+      result = right;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include "date.h"
+#include "event_dictionary.h"
+#include "node.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Outcome of evaluating a condition from the date alone.
+enum class DateVerdict { Reject, Accept, DependsOnEvent };
+
+// A condition flattened into straight-line code over one boolean register.
+// Comparisons overwrite the register; AND/OR become conditional jumps past
+// the right operand, so evaluation short-circuits without recursion,
+// virtual calls or shared_ptr traffic.
+class ConditionProgram {
+public:
+  enum class OpCode : uint8_t {
+    True,
+    // Same order as Comparison, so an opcode is base + comparison.
+    DateLess,
+    DateLessOrEqual,
+    DateGreater,
+    DateGreaterOrEqual,
+    DateEqual,
+    DateNotEqual,
+    EventLess,
+    EventLessOrEqual,
+    EventGreater,
+    EventGreaterOrEqual,
+    EventEqual,
+    EventNotEqual,
+    JumpIfFalse,
+    JumpIfTrue,
+  };
+  struct Instruction {
+    OpCode op;
+    // Index into the event literals for event comparisons.
+    uint32_t literal;
+    // Date key, bound event id or rank, or jump target.
+    int64_t operand;
+  };
+
+  static ConditionProgram Compile(const Node &node);
+
+  // Resolves event literals to ids and ranks; required before Evaluate and
+  // again after the dictionary changes. Binds only this copy: a Query's
+  // program is copied per call, so threads can share the Query.
+  void Bind(EventDictionary &dictionary);
+  // Same, against only the names `ranks` holds, which needs no lock.
+  void Bind(const EventDictionary &dictionary,
+            std::shared_ptr<const EventDictionary::RankTable> ranks);
+
+  // Decides for all events of a date at once where the date is enough.
+  // Once bound, it also knows that a name never interned matches nothing.
+  DateVerdict EvaluateDate(const Date &date) const;
+
+  bool Evaluate(const Date &date, EventId event) const {
+    const int64_t key = date.GetKey();
+    bool result = true;
+    const Instruction *code = code_.data();
+    const size_t size = code_.size();
+    for (size_t pc = 0; pc < size; ++pc) {
+      const Instruction &instruction = code[pc];
+      const int64_t operand = instruction.operand;
+      switch (instruction.op) {
+      case OpCode::True:
+        result = true;
+        break;
+      case OpCode::DateLess:
+        result = key < operand;
+        break;
+      case OpCode::DateLessOrEqual:
+        result = key <= operand;
+        break;
+      case OpCode::DateGreater:
+        result = key > operand;
+        break;
+      case OpCode::DateGreaterOrEqual:
+        result = key >= operand;
+        break;
+      case OpCode::DateEqual:
+        result = key == operand;
+        break;
+      case OpCode::DateNotEqual:
+        result = key != operand;
+        break;
+      case OpCode::EventLess:
+      case OpCode::EventLessOrEqual:
+        result = ranks_->ranks[event] < operand;
+        break;
+      case OpCode::EventGreater:
+      case OpCode::EventGreaterOrEqual:
+        result = ranks_->ranks[event] >= operand;
+        break;
+      case OpCode::EventEqual:
+        result = event == operand;
+        break;
+      case OpCode::EventNotEqual:
+        result = event != operand;
+        break;
+      case OpCode::JumpIfFalse:
+        if (!result) {
+          pc = operand - 1;
+        }
+        break;
+      case OpCode::JumpIfTrue:
+        if (result) {
+          pc = operand - 1;
+        }
+        break;
+      }
+    }
+    return result;
+  }
+
+  const std::vector<Instruction> &GetCode() const { return code_; }
+
+private:
+  void Emit(const Node &node);
+  // Evaluates code_[pc, end), one operand followed by the jumps of the
+  // operations it is the left side of, and leaves pc at end.
+  DateVerdict EvaluateDate(int64_t key, size_t &pc, size_t end) const;
+
+  std::vector<Instruction> code_;
+  std::vector<std::string> literals_;
+  std::shared_ptr<const EventDictionary::RankTable> ranks_;
+  bool bound_ = false;
+};
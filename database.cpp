@@ -1,108 +1,617 @@
 #include "database.h"
+#include "condition_parser.h"
+#include "snapshot.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include <iterator>
-void Database::Add(const Date &date, const std::string &event) {
-  if (eventsLast.count(date) == 0) {
-    eventsLast[date].push_back(event);
-    events[date].insert(event);
-    return;
+namespace {
+// LSD radix sort on the key, 16 bits per pass; stable like every pass.
+void StableSortByKey(std::vector<std::pair<int32_t, EventId>> &entries) {
+  constexpr int kDigitBits = 16;
+  constexpr uint32_t kDigits = 1u << kDigitBits;
+  std::vector<std::pair<int32_t, EventId>> sorted(entries.size());
+  std::vector<size_t> starts(kDigits + 1);
+  for (int shift = 0; shift < 32; shift += kDigitBits) {
+    // Flipping the sign bit makes negative keys sort first.
+    auto digit = [shift](int32_t key) {
+      return ((static_cast<uint32_t>(key) ^ 0x80000000u) >> shift) &
+             (kDigits - 1);
+    };
+    std::fill(starts.begin(), starts.end(), 0);
+    for (const auto &entry : entries) {
+      ++starts[digit(entry.first) + 1];
+    }
+    if (!entries.empty() && starts[digit(entries[0].first) + 1] ==
+                                entries.size()) {
+      continue;
+    }
+    for (uint32_t i = 0; i < kDigits; ++i) {
+      starts[i + 1] += starts[i];
+    }
+    for (const auto &entry : entries) {
+      sorted[starts[digit(entry.first)]++] = entry;
+    }
+    entries.swap(sorted);
   }
-  auto res = events.at(date).insert(event);
-  if (res.second) {
-    eventsLast[date].push_back(event);
+}
+} // namespace
+
+void Database::Add(const Date &date, std::string_view event) {
+  const EventId id = GetEventDictionary().Intern(event);
+  Detach(date);
+  if (events[date].Add(id)) {
+    Index(date, id);
+    Log(LogOp::Add, date, event);
   }
 };
 
-bool Database::DeleteEvent(const Date &date, const std::string &event) {
-  // if (events.find(date) != events.end()) {
-  //   if (events[date].find(event) != events[date].end()) {
-  //     events[date].erase(event);
-  //     return true;
-  //   }
-  // }
+void Database::BulkLoad(
+    const std::vector<std::pair<Date, std::string_view>> &entries) {
+  auto &dictionary = GetEventDictionary();
+  std::vector<std::pair<int32_t, EventId>> batch;
+  batch.reserve(entries.size());
+  for (const auto &[date, event] : entries) {
+    batch.emplace_back(date.GetKey(), dictionary.Intern(event));
+  }
+  StableSortByKey(batch);
 
-  return false;
+  // Number of the last date group each event was seen in, for dedup.
+  std::vector<size_t> seen_in(dictionary.Size(), 0);
+  std::vector<EventId> added;
+  auto bucket = events.begin();
+  for (size_t begin = 0, group = 1; begin < batch.size(); ++group) {
+    const Date date = Date::FromKey(batch[begin].first);
+    std::vector<EventId> ids;
+    size_t end = begin;
+    for (; end < batch.size() && batch[end].first == batch[begin].first;
+         ++end) {
+      const EventId id = batch[end].second;
+      if (seen_in[id] != group) {
+        seen_in[id] = group;
+        ids.push_back(id);
+      }
+    }
+    begin = end;
+
+    Detach(date);
+    while (bucket != events.end() && bucket->first < date) {
+      ++bucket;
+    }
+    added.clear();
+    if (bucket != events.end() && bucket->first == date) {
+      for (EventId id : ids) {
+        if (bucket->second.Add(id)) {
+          added.push_back(id);
+        }
+      }
+    } else {
+      bucket = events.emplace_hint(bucket, date, EventSet(ids));
+      added = std::move(ids);
+    }
+    for (EventId id : added) {
+      Index(date, id);
+      if (log != nullptr) {
+        log->Append({++log_position, LogOp::Add, date, dictionary.Name(id)});
+      }
+    }
+  }
+  // Only now, so that no compaction captures entries logged after it.
+  CompactIfDue();
+}
+
+bool Database::DeleteEvent(const Date &date, const std::string &event) {
+  Detach(date);
+  auto it = events.find(date);
+  const EventId id = GetEventDictionary().Find(event);
+  if (it == events.end() || id == kNoEvent) {
+    return false;
+  }
+  const int removed =
+      it->second.RemoveIf([id](EventId current) { return current == id; });
+  if (removed > 0) {
+    Unindex(date, id);
+  }
+  if (it->second.Empty()) {
+    events.erase(it);
+  }
+  if (removed > 0) {
+    Log(LogOp::DeleteEvent, date, event);
+  }
+  return removed > 0;
 }
 int Database::DeleteDate(const Date &date) {
+  Detach(date);
   int size = 0;
-  if (events.find(date) != events.end()) {
-    size = events[date].size();
-    events.erase(date);
+  auto it = events.find(date);
+  if (it != events.end()) {
+    size = it->second.Size();
+    for (EventId event : it->second.GetAll()) {
+      Unindex(date, event);
+    }
+    events.erase(it);
+    Log(LogOp::DeleteDate, date, {});
   }
   return size;
 }
 
 void Database::Find(const Date &date) const {
-  if (events.find(date) != events.end()) {
-    for (const auto &i : events.at(date))
-      std::cout << i << std::endl;
-  }
+  ForEachBucket({date, date}, [](const Date &, const auto &bucket) {
+    const auto &dictionary = GetEventDictionary();
+    std::vector<const std::string *> sorted;
+    for (EventId event : bucket) {
+      sorted.push_back(&dictionary.Name(event));
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto *lhs, const auto *rhs) { return *lhs < *rhs; });
+    for (const auto *i : sorted)
+      std::cout << *i << '\n';
+  });
 };
 
 void Database::Print(std::ostream &out) const {
-  for (const auto &i : eventsLast) {
-    for (const auto &j : eventsLast.at(i.first)) {
-      out << i.first << " " << j << std::endl;
+  OutputBuffer buffer(out);
+  Print(buffer);
+};
+
+void Database::Print(OutputBuffer &out) const {
+  const auto &dictionary = GetEventDictionary();
+  ForEachBucket(DateRange(), [&](const Date &date, const auto &bucket) {
+    for (EventId event : bucket) {
+      out << date << ' ' << dictionary.Name(event) << '\n';
     }
+  });
+}
+
+int Database::RemoveIf(const Query &query) {
+  const ConditionProgram program = BindQuery(query);
+  int count;
+  if (event_index_enabled && query.event) {
+    count = RemoveIndexed(query, program);
+  } else if (GetPool().GetConcurrency() > 1) {
+    count = RemoveEventsInParallel(query, program);
+  } else {
+    count = RemoveEvents(
+        query.dates,
+        [&program](const Date &date) { return program.EvaluateDate(date); },
+        [&program](const Date &date, EventId event) {
+          return program.Evaluate(date, event);
+        });
   }
-};
+  if (count > 0) {
+    Log(LogOp::Del, Date(), query.text);
+  }
+  return count;
+}
 
-int Database::RemoveIf(
-    const std::function<bool(const Date &, const std::string &)> predicate) {
-  int count = 0;
+int Database::RemoveEventsInParallel(const Query &query,
+                                     const ConditionProgram &program) {
+  auto date_filter = [&program](const Date &date) {
+    return program.EvaluateDate(date);
+  };
+  auto predicate = [&program](const Date &date, EventId event) {
+    return program.Evaluate(date, event);
+  };
+  const DateRange &dates = query.dates;
+  if (dates.Empty()) {
+    return 0;
+  }
+  DetachMatching(dates, date_filter, predicate);
 
-  auto mit = eventsLast.begin();
-  while (mit != eventsLast.end()) {
-    bool bErase = false;
-    auto it = std::stable_partition(mit->second.begin(), mit->second.end(),
-                                    [&predicate, mit](const auto &iset) {
-                                      return !predicate(mit->first, iset);
-                                    });
-    if (it != mit->second.end()) {
-      bErase = true;
-      count += std::distance(it, mit->second.end());
-      mit->second.erase(it, mit->second.end());
-    }
-    if (bErase) {
-      events.at(mit->first).clear();
-      std::copy(
-          mit->second.begin(), mit->second.end(),
-          std::inserter(events.at(mit->first), events.at(mit->first).begin()));
-    }
-    if (mit->second.empty()) {
-      events.erase(mit->first);
-      mit = eventsLast.erase(mit);
-    } else {
-      mit++;
+  // Consecutive buckets of about kPartitionEvents events per task; a
+  // single task runs on this thread alone.
+  std::vector<std::map<Date, EventSet>::iterator> buckets;
+  std::vector<size_t> starts;
+  size_t size = 0;
+  const auto end = events.upper_bound(dates.last);
+  for (auto it = events.lower_bound(dates.first); it != end; ++it) {
+    if (starts.empty() || size >= kPartitionEvents) {
+      starts.push_back(buckets.size());
+      size = 0;
     }
+    size += it->second.Size();
+    buckets.push_back(it);
   }
+  starts.push_back(buckets.size());
 
+  // What each task removed, the events only if the index needs them.
+  struct Removal {
+    int count = 0;
+    std::vector<std::pair<Date, EventId>> events;
+    std::vector<std::map<Date, EventSet>::iterator> emptied;
+  };
+  std::vector<Removal> removals(starts.size() - 1);
+  GetPool().ParallelFor(removals.size(), [&](size_t i) {
+    Removal &removal = removals[i];
+    for (size_t j = starts[i]; j < starts[i + 1]; ++j) {
+      removal.count += RemoveFromBucket(
+          buckets[j]->first, buckets[j]->second, date_filter, predicate,
+          [&](const Date &date, EventId event) {
+            if (event_index_enabled) {
+              removal.events.emplace_back(date, event);
+            }
+          });
+      if (buckets[j]->second.Empty()) {
+        removal.emptied.push_back(buckets[j]);
+      }
+    }
+  });
+
+  int count = 0;
+  for (const Removal &removal : removals) {
+    count += removal.count;
+    for (const auto &[date, event] : removal.events) {
+      Unindex(date, event);
+    }
+    for (auto it : removal.emptied) {
+      events.erase(it);
+    }
+  }
   return count;
 }
 
-std::vector<std::string> Database::FindIf(
-    const std::function<bool(const Date &, const std::string &)> predicate)
-    const {
+std::vector<std::string> Database::FindIf(const Query &query) const {
+  // Partitioning costs a pass over the buckets, wasted on a single thread.
+  std::vector<DateRange> partitions;
+  if (!(event_index_enabled && query.event) &&
+      GetPool().GetConcurrency() > 1) {
+    partitions = PartitionByEvents(query.dates);
+  }
+  if (partitions.size() < 2) {
+    EntryCollector collector;
+    ForEachIf(query, [&collector](const Date &date, std::string_view event) {
+      collector(date, event);
+    });
+    return std::move(collector.entries);
+  }
+
+  const ConditionProgram program = BindQuery(query);
+  const auto &dictionary = GetEventDictionary();
+  std::vector<EntryCollector> collectors(partitions.size());
+  GetPool().ParallelFor(partitions.size(), [&](size_t i) {
+    EntryCollector &collector = collectors[i];
+    VisitEvents(
+        partitions[i],
+        [&program](const Date &date) { return program.EvaluateDate(date); },
+        [&program](const Date &date, EventId event) {
+          return program.Evaluate(date, event);
+        },
+        [&](const Date &date, EventId event) {
+          collector(date, dictionary.Name(event));
+        });
+  });
+
+  size_t total = 0;
+  for (const EntryCollector &collector : collectors) {
+    total += collector.entries.size();
+  }
   std::vector<std::string> entries;
-  for (const auto &e : eventsLast) {
-    auto it = e.second.begin();
-    while (it != e.second.end()) {
-      it = std::find_if(it, e.second.end(), [&predicate, e](const auto &iset) {
-        return predicate(e.first, iset);
-      });
-      if (it != e.second.end()) {
-        entries.emplace_back(e.first.getDate() + " " + *it);
-        it++;
+  entries.reserve(total);
+  for (EntryCollector &collector : collectors) {
+    std::move(collector.entries.begin(), collector.entries.end(),
+              std::back_inserter(entries));
+  }
+  return entries;
+}
+
+std::vector<DateRange>
+Database::PartitionByEvents(const DateRange &dates) const {
+  std::vector<DateRange> partitions;
+  size_t size = 0;
+  ForEachBucket(dates, [&](const Date &date, const auto &bucket) {
+    if (partitions.empty() || size >= kPartitionEvents) {
+      if (!partitions.empty()) {
+        partitions.back().last = Date::FromKey(date.GetKey() - 1);
       }
+      partitions.push_back({date, dates.last});
+      size = 0;
     }
+    size += bucket.size();
+  });
+  return partitions;
+}
+
+ThreadPool &Database::GetPool() const {
+  return pool != nullptr ? *pool : GetThreadPool();
+}
+
+ConditionProgram Database::BindQuery(const Query &query) const {
+  ConditionProgram program = query.program;
+  program.Bind(GetEventDictionary());
+  return program;
+}
+
+int Database::RemoveIndexed(const Query &query,
+                            const ConditionProgram &program) {
+  const EventId id = GetEventDictionary().Find(*query.event);
+  auto index = dates_by_event.find(id);
+  if (index == dates_by_event.end() || query.dates.Empty()) {
+    return 0;
+  }
+  auto &dates = index->second;
+  int count = 0;
+  auto it = dates.lower_bound(query.dates.first);
+  const auto end = dates.upper_bound(query.dates.last);
+  while (it != end) {
+    if (!program.Evaluate(*it, id)) {
+      ++it;
+      continue;
+    }
+    Detach(*it);
+    auto bucket = events.find(*it);
+    bucket->second.RemoveIf([id](EventId event) { return event == id; });
+    if (bucket->second.Empty()) {
+      events.erase(bucket);
+    }
+    ++count;
+    it = dates.erase(it);
+  }
+  if (dates.empty()) {
+    dates_by_event.erase(index);
+  }
+  return count;
+}
+
+void Database::EnableEventIndex(bool enabled) {
+  event_index_enabled = enabled;
+  dates_by_event.clear();
+  if (!enabled) {
+    return;
+  }
+  ForEachBucket(DateRange(), [this](const Date &date, const auto &bucket) {
+    for (EventId event : bucket) {
+      dates_by_event[event].insert(date);
+    }
+  });
+}
+
+void Database::Save(const std::string &path,
+                    SnapshotEncoding encoding) const {
+  WriteSnapshot(path, Capture(), encoding);
+}
+
+SnapshotColumns Database::Capture() const {
+  const auto &dictionary = GetEventDictionary();
+  SnapshotColumns columns;
+  columns.log_position = log_position;
+  // The snapshot gets its own dictionary with only the names still in use.
+  std::vector<uint32_t> local_ids(dictionary.Size(), kNoEvent);
+  columns.dates.reserve(events.size());
+  columns.offsets.reserve(events.size() + 1);
+  columns.offsets.push_back(0);
+  ForEachBucket(DateRange(), [&](const Date &date, const auto &bucket) {
+    columns.dates.push_back(date.GetKey());
+    for (EventId event : bucket) {
+      if (local_ids[event] == kNoEvent) {
+        local_ids[event] = columns.names.size();
+        columns.names.push_back(dictionary.Name(event));
+      }
+      columns.events.push_back(local_ids[event]);
+    }
+    columns.offsets.push_back(columns.events.size());
+  });
+  return columns;
+}
+
+void Database::Load(const std::string &path) {
+  const std::vector<char> data = ReadFile(path);
+  LoadColumns(
+      ParseSnapshot(data.data(), data.size(), SnapshotCheck::Dictionary));
+  if (log != nullptr) {
+    Checkpoint();
   }
-  return entries;
+}
+
+void Database::LoadColumns(const SnapshotView &view) {
+  auto &dictionary = GetEventDictionary();
+  std::vector<EventId> ids(view.name_count);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    ids[i] = dictionary.Intern(view.Name(i));
+  }
+
+  // Chunks are checked and built into maps of their own in parallel, then
+  // spliced together in date order.
+  std::vector<std::map<Date, EventSet>> parts(view.chunk_count);
+  GetPool().ParallelFor(view.chunk_count, [&](size_t chunk) {
+    SnapshotChunkReader reader(view, chunk);
+    std::map<Date, EventSet> &part = parts[chunk];
+    std::vector<uint32_t> sorted;
+    while (reader.Next()) {
+      const uint32_t *first = reader.Events();
+      const uint32_t *last = first + reader.EventCount();
+      sorted.assign(first, last);
+      std::sort(sorted.begin(), sorted.end());
+      if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+        throw CorruptSnapshot("Corrupt snapshot: repeated event");
+      }
+      std::vector<EventId> bucket;
+      bucket.reserve(last - first);
+      for (; first != last; ++first) {
+        bucket.push_back(ids[*first]);
+      }
+      part.emplace_hint(part.end(), Date::FromKey(reader.DateKey()),
+                        EventSet(std::move(bucket)));
+    }
+  });
+  std::map<Date, EventSet> loaded;
+  for (auto &part : parts) {
+    while (!part.empty()) {
+      loaded.insert(loaded.end(), part.extract(part.begin()));
+    }
+  }
+  events = std::move(loaded);
+  mapped.reset();
+  snapshot = SnapshotView();
+  snapshot_ids.clear();
+  shadowed.clear();
+  checked_chunks.reset();
+  EnableEventIndex(event_index_enabled);
+}
+
+void Database::Open(const std::string &path) {
+  auto file = std::make_shared<const MappedFile>(path);
+  const SnapshotView view =
+      ParseSnapshot(file->Data(), file->Size(), SnapshotCheck::Dictionary);
+  if (view.encoding != SnapshotEncoding::Plain) {
+    LoadColumns(view);
+    if (log != nullptr) {
+      Checkpoint();
+    }
+    return;
+  }
+  // The index reads every bucket anyway, so a corrupt chunk can fail Open
+  // before anything is replaced.
+  auto checked = std::make_unique<std::atomic<bool>[]>(view.chunk_count);
+  if (event_index_enabled) {
+    for (size_t i = 0; i < view.chunk_count; ++i) {
+      VerifySnapshotChunk(view, i);
+      checked[i] = true;
+    }
+  }
+  auto &dictionary = GetEventDictionary();
+  std::vector<EventId> ids(view.name_count);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    ids[i] = dictionary.Intern(view.Name(i));
+  }
+  events.clear();
+  mapped = std::move(file);
+  snapshot = view;
+  snapshot_ids = std::move(ids);
+  shadowed.assign(view.date_count, false);
+  checked_chunks = std::move(checked);
+  EnableEventIndex(event_index_enabled);
+  if (log != nullptr) {
+    Checkpoint();
+  }
+}
+
+uint64_t Database::Recover(const std::string &log_path) {
+  const std::string checkpoint = WriteAheadLog::CheckpointPath(log_path);
+  if (std::ifstream(checkpoint).good()) {
+    const std::vector<char> data = ReadFile(checkpoint);
+    const SnapshotView view =
+        ParseSnapshot(data.data(), data.size(), SnapshotCheck::Dictionary);
+    LoadColumns(view);
+    log_position = view.log_position;
+  }
+  auto replay = [this](const LogRecord &record) {
+    // Records a crash left behind after the checkpoint was saved.
+    if (record.position <= log_position) {
+      return;
+    }
+    switch (record.op) {
+    case LogOp::Add:
+      Add(record.date, record.text);
+      break;
+    case LogOp::Del:
+      RemoveIf(ParseQuery(record.text));
+      break;
+    case LogOp::DeleteDate:
+      DeleteDate(record.date);
+      break;
+    case LogOp::DeleteEvent:
+      DeleteEvent(record.date, std::string(record.text));
+      break;
+    }
+    log_position = record.position;
+  };
+  // A compaction that didn't finish left the older records here.
+  ReadLog(WriteAheadLog::RotatedPath(log_path), replay);
+  return ReadLog(log_path, replay);
+}
+
+void Database::Checkpoint() {
+  if (log == nullptr) {
+    throw std::logic_error("Checkpoint needs a log");
+  }
+  if (compactor != nullptr) {
+    compactor->Wait();
+  }
+  // Save syncs the snapshot's rename before the log is emptied.
+  Save(WriteAheadLog::CheckpointPath(log->GetPath()));
+  log->Reset();
+  const std::string rotated = WriteAheadLog::RotatedPath(log->GetPath());
+  std::remove(rotated.c_str());
+  SyncDirectory(rotated);
+}
+
+void Database::Compact() {
+  const auto start = std::chrono::steady_clock::now();
+  SnapshotColumns columns = Capture();
+  compactor->Start(std::move(columns),
+                   std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - start));
+}
+
+size_t Database::SnapshotLowerBound(const Date &date) const {
+  return std::lower_bound(snapshot.dates, snapshot.dates + snapshot.date_count,
+                          date.GetKey()) -
+         snapshot.dates;
+}
+
+size_t Database::SnapshotUpperBound(const Date &date) const {
+  return std::upper_bound(snapshot.dates, snapshot.dates + snapshot.date_count,
+                          date.GetKey()) -
+         snapshot.dates;
+}
+
+void Database::CheckSnapshotChunk(size_t index) const {
+  const SnapshotChunk *chunks = snapshot.chunks;
+  const size_t chunk =
+      std::upper_bound(chunks, chunks + snapshot.chunk_count, index,
+                       [](size_t date, const SnapshotChunk &chunk) {
+                         return date < chunk.first_date;
+                       }) -
+      chunks - 1;
+  if (!checked_chunks[chunk].load(std::memory_order_acquire)) {
+    VerifySnapshotChunk(snapshot, chunk);
+    checked_chunks[chunk].store(true, std::memory_order_release);
+  }
+}
+
+void Database::Detach(const Date &date) {
+  if (snapshot.date_count == 0) {
+    return;
+  }
+  const size_t index = SnapshotLowerBound(date);
+  if (index < snapshot.date_count && snapshot.dates[index] == date.GetKey() &&
+      !shadowed[index]) {
+    Detach(index);
+  }
+}
+
+void Database::Detach(size_t index) {
+  const SnapshotBucket bucket = GetSnapshotBucket(index);
+  events.emplace(Date::FromKey(snapshot.dates[index]),
+                 EventSet(std::vector<EventId>(bucket.begin(), bucket.end())));
+  shadowed[index] = true;
 }
 
 std::string Database::Last(const Date &date) const {
-  auto it = eventsLast.upper_bound(date);
-  if (it == eventsLast.begin())
+  auto it = events.upper_bound(date);
+  bool found = it != events.begin();
+  Date last_date;
+  EventId last_event = kNoEvent;
+  if (found) {
+    it--;
+    last_date = it->first;
+    last_event = it->second.GetAll().back();
+  }
+  for (size_t i = SnapshotUpperBound(date); i-- > 0;) {
+    const Date mapped_date = Date::FromKey(snapshot.dates[i]);
+    if (found && mapped_date < last_date) {
+      break;
+    }
+    if (!shadowed[i]) {
+      found = true;
+      last_date = mapped_date;
+      last_event = GetSnapshotBucket(i).back();
+      break;
+    }
+  }
+  if (!found)
     throw std::invalid_argument("Last not found");
-  it--;
-  return {it->first.getDate() + " " + it->second.back()};
-}
\ No newline at end of file
+  return {last_date.getDate() + " " + GetEventDictionary().Name(last_event)};
+}
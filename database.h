@@ -1,25 +1,396 @@
 #pragma once
+#include "compactor.h"
 #include "date.h"
-#include <functional>
+#include "event_set.h"
+#include "output_buffer.h"
+#include "query.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "wal.h"
+#include <atomic>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 class Database {
 public:
-  void Add(const Date &date, const std::string &event);
+  void Add(const Date &date, std::string_view event);
+  // Same result as calling Add for every entry in order, but the entries
+  // are stably sorted by date and each date's bucket is built at once, in
+  // one pass over the batch and the existing dates.
+  void BulkLoad(const std::vector<std::pair<Date, std::string_view>> &entries);
   bool DeleteEvent(const Date &date, const std::string &event);
   int DeleteDate(const Date &date);
   void Find(const Date &date) const;
   void Print(std::ostream &out) const;
-  int RemoveIf(
-      const std::function<bool(const Date &, const std::string &)> predicate);
-  std::vector<std::string>
-  FindIf(const std::function<bool(const Date &, const std::string &)> predicate)
-      const;
+  void Print(OutputBuffer &out) const;
+  // Predicate is called as predicate(const Date &, const std::string &).
+  // An arbitrary predicate can't be logged, so this throws with a log set.
+  template <typename Predicate> int RemoveIf(Predicate predicate) {
+    if (log != nullptr) {
+      throw std::logic_error("RemoveIf(predicate) can't be logged");
+    }
+    const auto &dictionary = GetEventDictionary();
+    return RemoveEvents(DateRange(), AnyDate,
+                        [&](const Date &date, EventId event) {
+                          return predicate(date, dictionary.Name(event));
+                        });
+  }
+  template <typename Predicate>
+  std::vector<std::string> FindIf(Predicate predicate) const {
+    const auto &dictionary = GetEventDictionary();
+    EntryCollector collector;
+    VisitEvents(
+        DateRange(), AnyDate,
+        [&](const Date &date, EventId event) {
+          return predicate(date, dictionary.Name(event));
+        },
+        [&](const Date &date, EventId event) {
+          collector(date, dictionary.Name(event));
+        });
+    return std::move(collector.entries);
+  }
+  // Fast path for parsed conditions: only dates within query.dates are
+  // visited, and the compiled program runs on interned event ids. Unless
+  // the event index serves it, buckets are filtered on the thread pool.
+  int RemoveIf(const Query &query);
+  // Unless the event index serves it, a query over many events is split
+  // into date ranges evaluated on the thread pool; the result is the same.
+  std::vector<std::string> FindIf(const Query &query) const;
+  // Streams the entries FindIf(query) would return, in the same order, as
+  // visitor(const Date &, std::string_view) and returns their number. The
+  // view stays valid for the lifetime of the process.
+  template <typename Visitor>
+  int ForEachIf(const Query &query, Visitor visitor) const {
+    const ConditionProgram program = BindQuery(query);
+    const auto &dictionary = GetEventDictionary();
+    auto visit = [&](const Date &date, EventId event) {
+      visitor(date, std::string_view(dictionary.Name(event)));
+    };
+    if (event_index_enabled && query.event) {
+      return VisitIndexed(query, program, visit);
+    }
+    return VisitEvents(
+        query.dates,
+        [&program](const Date &date) { return program.EvaluateDate(date); },
+        [&program](const Date &date, EventId event) {
+          return program.Evaluate(date, event);
+        },
+        visit);
+  }
   std::string Last(const Date &date) const;
 
+  // Keeps, for every event, the ordered set of dates holding it, so that
+  // queries whose top-level conjunction has `event == X` visit only those
+  // dates. Off by default: it costs a tree insert per Add.
+  void EnableEventIndex(bool enabled);
+  bool IsEventIndexEnabled() const { return event_index_enabled; }
+  // Events the index holds dates for; only events still present count.
+  size_t GetIndexedEventCount() const { return dates_by_event.size(); }
+
+  // Writes every entry to a binary snapshot (see snapshot.h). A compressed
+  // one is smaller but can only be loaded, not served in place.
+  void Save(const std::string &path,
+            SnapshotEncoding encoding = SnapshotEncoding::Plain) const;
+  // Replaces the contents with the snapshot's. The date buckets are built
+  // from the sorted columns without going through Add, each chunk of the
+  // snapshot checked and built on its own thread of the pool. With a
+  // log set, this and Open end with a Checkpoint, since the log can't
+  // replay them.
+  void Load(const std::string &path);
+  // Replaces the contents with the snapshot's, served in place from a
+  // read-only mapping: only the name dictionary is read up front, and
+  // queries binary-search the date column. A date changed afterwards gets
+  // its bucket copied into memory and is answered from there. The names
+  // and the chunk table are checked up front and each chunk of the columns
+  // when one of its events is first read, so a corrupt chunk makes every
+  // call that reads it throw CorruptSnapshot; a date column out of order
+  // only misplaces its dates. An enabled event index is still built from
+  // every bucket. A compressed snapshot is decoded from the mapping like
+  // Load does instead.
+  void Open(const std::string &path);
+
+  // Every mutation that changes something is appended to `log`, numbered
+  // by its position. Null stops logging.
+  void SetLog(WriteAheadLog *log) { this->log = log; }
+  // Lets `compactor`, which works on the log set above, turn the log into
+  // a snapshot whenever its policy says so. Each time the contents are
+  // captured in one pass, and the rest is done in the background.
+  void SetCompactor(Compactor *compactor) { this->compactor = compactor; }
+  const Compactor *GetCompactor() const { return compactor; }
+  // Pool that loads snapshots and runs FindIf and RemoveIf over many
+  // events; the shared one by default. Parallel queries are skipped on a
+  // pool of one thread.
+  void SetThreadPool(ThreadPool *pool) { this->pool = pool; }
+  // Rebuilds the contents from the log at `log_path`: loads its checkpoint
+  // snapshot, if any, then replays the records after it. Returns the size
+  // of the intact part of the log. Called before SetLog.
+  uint64_t Recover(const std::string &log_path);
+  // Saves a snapshot next to the log holding everything logged so far and
+  // empties the log, waiting for a running compaction first.
+  void Checkpoint();
+
 private:
-  std::map<Date, std::vector<std::string>> eventsLast;
-  std::map<Date, std::set<std::string>> events;
-};
\ No newline at end of file
+  void Index(const Date &date, EventId event) {
+    if (event_index_enabled) {
+      dates_by_event[event].insert(date);
+    }
+  }
+  void Unindex(const Date &date, EventId event) {
+    if (!event_index_enabled) {
+      return;
+    }
+    auto index = dates_by_event.find(event);
+    if (index != dates_by_event.end()) {
+      index->second.erase(date);
+      if (index->second.empty()) {
+        dates_by_event.erase(index);
+      }
+    }
+  }
+
+  void Log(LogOp op, const Date &date, std::string_view text) {
+    if (log != nullptr) {
+      log->Append({++log_position, op, date, text});
+      CompactIfDue();
+    }
+  }
+  void CompactIfDue() {
+    if (compactor != nullptr && compactor->Due()) {
+      Compact();
+    }
+  }
+  void Compact();
+  // Everything Save writes, in the snapshot's terms.
+  SnapshotColumns Capture() const;
+  void LoadColumns(const SnapshotView &view);
+
+  // Positions in the snapshot's date column.
+  size_t SnapshotLowerBound(const Date &date) const;
+  size_t SnapshotUpperBound(const Date &date) const;
+  // Checks the chunk holding dates[index] first if no read has yet.
+  SnapshotBucket GetSnapshotBucket(size_t index) const {
+    CheckSnapshotChunk(index);
+    return SnapshotBucket(snapshot, index, snapshot_ids.data());
+  }
+  void CheckSnapshotChunk(size_t index) const;
+  // Copies the snapshot's bucket of `date`, if the snapshot still serves
+  // it, into `events` so that it can be changed.
+  void Detach(const Date &date);
+  void Detach(size_t index);
+
+  // Calls f(const Date &, const Bucket &) for every date in `dates`, in
+  // order, where Bucket is an iterable of EventIds with size() and back():
+  // the in-memory bucket if there is one, the snapshot's otherwise.
+  template <typename F> void ForEachBucket(const DateRange &dates, F f) const {
+    if (dates.Empty()) {
+      return;
+    }
+    auto memory = events.lower_bound(dates.first);
+    const auto memory_end = events.upper_bound(dates.last);
+    size_t mapped_index = SnapshotLowerBound(dates.first);
+    const size_t mapped_end = SnapshotUpperBound(dates.last);
+    while (true) {
+      while (mapped_index < mapped_end && shadowed[mapped_index]) {
+        ++mapped_index;
+      }
+      if (mapped_index == mapped_end) {
+        for (; memory != memory_end; ++memory) {
+          f(memory->first, memory->second.GetAll());
+        }
+        return;
+      }
+      const Date mapped_date = Date::FromKey(snapshot.dates[mapped_index]);
+      if (memory != memory_end && memory->first < mapped_date) {
+        f(memory->first, memory->second.GetAll());
+        ++memory;
+      } else {
+        f(mapped_date, GetSnapshotBucket(mapped_index));
+        ++mapped_index;
+      }
+    }
+  }
+  // Splits the dates of `dates` that hold events into consecutive ranges of
+  // about kPartitionEvents events each, so that ranges of sparse dates are
+  // wide and dense dates get ranges of their own.
+  static constexpr size_t kPartitionEvents = 1 << 14;
+  std::vector<DateRange> PartitionByEvents(const DateRange &dates) const;
+  ThreadPool &GetPool() const;
+  // Returns a copy of the query's program, bound; the query is unchanged.
+  ConditionProgram BindQuery(const Query &query) const;
+  int RemoveIndexed(const Query &query, const ConditionProgram &program);
+
+  // Builds "date event" lines, formatting each date once.
+  struct EntryCollector {
+    std::vector<std::string> entries;
+    Date last_date;
+    std::string prefix;
+
+    void operator()(const Date &date, std::string_view event) {
+      if (prefix.empty() || date != last_date) {
+        last_date = date;
+        prefix = date.getDate() + " ";
+      }
+      entries.emplace_back(prefix);
+      entries.back().append(event);
+    }
+  };
+
+  // Every entry the query accepts carries query.event, so only the dates
+  // indexed for it are visited, and within a date only that event; one
+  // entry per date keeps the output in Print order.
+  template <typename Visitor>
+  int VisitIndexed(const Query &query, const ConditionProgram &program,
+                   Visitor visitor) const {
+    const EventId id = GetEventDictionary().Find(*query.event);
+    auto index = dates_by_event.find(id);
+    if (index == dates_by_event.end() || query.dates.Empty()) {
+      return 0;
+    }
+    int count = 0;
+    const auto &dates = index->second;
+    const auto end = dates.upper_bound(query.dates.last);
+    for (auto it = dates.lower_bound(query.dates.first); it != end; ++it) {
+      if (program.Evaluate(*it, id)) {
+        visitor(*it, id);
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  // DateFilter maps a date to a DateVerdict; Predicate is only asked about
+  // the events of dates that got DateVerdict::DependsOnEvent.
+  static DateVerdict AnyDate(const Date &) {
+    return DateVerdict::DependsOnEvent;
+  }
+
+  template <typename DateFilter, typename Predicate>
+  int RemoveEvents(const DateRange &dates, DateFilter date_filter,
+                   Predicate predicate) {
+    if (dates.Empty()) {
+      return 0;
+    }
+    DetachMatching(dates, date_filter, predicate);
+    int count = 0;
+    auto mit = events.lower_bound(dates.first);
+    const auto end = events.upper_bound(dates.last);
+    while (mit != end) {
+      count += RemoveFromBucket(
+          mit->first, mit->second, date_filter, predicate,
+          [this](const Date &date, EventId event) { Unindex(date, event); });
+      if (mit->second.Empty()) {
+        mit = events.erase(mit);
+      } else {
+        mit++;
+      }
+    }
+    return count;
+  }
+  // Like RemoveEvents for a query, with the in-memory buckets filtered on
+  // the thread pool; only unindexing and erasing emptied buckets are left
+  // to this thread.
+  int RemoveEventsInParallel(const Query &query,
+                             const ConditionProgram &program);
+
+  // Moves into memory the snapshot's dates within `dates` that have a
+  // matching event; the others are served from the snapshot unchanged.
+  template <typename DateFilter, typename Predicate>
+  void DetachMatching(const DateRange &dates, DateFilter date_filter,
+                      Predicate predicate) {
+    const size_t mapped_end = SnapshotUpperBound(dates.last);
+    for (size_t i = SnapshotLowerBound(dates.first); i < mapped_end; ++i) {
+      if (shadowed[i]) {
+        continue;
+      }
+      const Date date = Date::FromKey(snapshot.dates[i]);
+      const DateVerdict verdict = date_filter(date);
+      bool changes = verdict == DateVerdict::Accept;
+      if (verdict == DateVerdict::DependsOnEvent) {
+        for (EventId event : GetSnapshotBucket(i)) {
+          if (predicate(date, event)) {
+            changes = true;
+            break;
+          }
+        }
+      }
+      if (changes) {
+        Detach(i);
+      }
+    }
+  }
+
+  // Drops the matching events of one in-memory bucket, calling
+  // removed(date, event) for each, and returns their number. The bucket
+  // may be left empty.
+  template <typename DateFilter, typename Predicate, typename Removed>
+  static int RemoveFromBucket(const Date &date, EventSet &bucket,
+                              DateFilter &date_filter, Predicate &predicate,
+                              Removed removed) {
+    const DateVerdict verdict = date_filter(date);
+    if (verdict == DateVerdict::Accept) {
+      for (EventId event : bucket.GetAll()) {
+        removed(date, event);
+      }
+      const int count = static_cast<int>(bucket.Size());
+      bucket = EventSet();
+      return count;
+    }
+    if (verdict == DateVerdict::DependsOnEvent) {
+      return bucket.RemoveIf([&](EventId event) {
+        if (!predicate(date, event)) {
+          return false;
+        }
+        removed(date, event);
+        return true;
+      });
+    }
+    return 0;
+  }
+
+  // Visitor is called as visitor(const Date &, EventId) for every match.
+  template <typename DateFilter, typename Predicate, typename Visitor>
+  int VisitEvents(const DateRange &dates, DateFilter date_filter,
+                  Predicate predicate, Visitor visitor) const {
+    int count = 0;
+    ForEachBucket(dates, [&](const Date &date, const auto &bucket) {
+      const DateVerdict verdict = date_filter(date);
+      if (verdict == DateVerdict::Reject) {
+        return;
+      }
+      for (EventId event : bucket) {
+        if (verdict == DateVerdict::Accept || predicate(date, event)) {
+          visitor(date, event);
+          ++count;
+        }
+      }
+    });
+    return count;
+  }
+
+  std::map<Date, EventSet> events;
+  bool event_index_enabled = false;
+  std::unordered_map<EventId, std::set<Date>> dates_by_event;
+
+  // Set by Open. The snapshot's name ids map to dictionary ids through
+  // snapshot_ids; a date with `shadowed` set has changed since and is
+  // served from `events`, or is gone.
+  std::shared_ptr<const MappedFile> mapped;
+  SnapshotView snapshot;
+  std::vector<EventId> snapshot_ids;
+  std::vector<bool> shadowed;
+  // Per chunk of the snapshot, whether it was verified; set by whichever
+  // reading thread gets there first.
+  mutable std::unique_ptr<std::atomic<bool>[]> checked_chunks;
+
+  WriteAheadLog *log = nullptr;
+  Compactor *compactor = nullptr;
+  ThreadPool *pool = nullptr;
+  // Position of the last logged or replayed record.
+  uint64_t log_position = 0;
+};
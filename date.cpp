@@ -1,87 +1,133 @@
 #include "date.h"
-#include <vector>
+#include <climits>
 
-Date::Date(std::string &date) {
-  CheckDate(date);
-  std::stringstream ss(date);
-  ss >> year;
-  ss.ignore();
-  ss >> month;
-  ss.ignore();
-  ss >> day;
-}
-Date::Date(int Year, int Month, int Day) : year(Year), month(Month), day(Day) {}
+namespace {
+struct DigitPairs {
+  char data[200];
+  constexpr DigitPairs() : data() {
+    for (int i = 0; i < 100; ++i) {
+      data[2 * i] = static_cast<char>('0' + i / 10);
+      data[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+  }
+};
+constexpr DigitPairs kDigitPairs;
 
-void Date::CheckDate(const std::string &date) {
-  std::stringstream ss(date);
-  int in;
-  ss >> in;
-  if (ss.peek() != '-') {
-    throw std::runtime_error("Wrong date format: " + date);
-  }
-  ss.ignore();
-  ss >> in;
-  if (ss.peek() != '-') {
-    throw std::runtime_error("Wrong date format: " + date);
-  }
-  if (in < 1 || 12 < in) {
-    throw std::runtime_error("Month value is invalid: " + std::to_string(in));
+bool IsSpace(char c) { return c == ' ' || ('\t' <= c && c <= '\r'); }
+bool IsDigit(char c) { return '0' <= c && c <= '9'; }
 
-  } else {
-    ss.ignore();
-    ss >> in;
-    if (in < 1 || 31 < in) {
-      throw std::runtime_error("Day value is invalid: " + std::to_string(in));
+// Reads an int the way `istream >> int` does: leading spaces, optional sign,
+// at least one digit. On failure `value` gets what the stream would store
+// (0, or INT_MAX/INT_MIN on overflow) and false is returned.
+bool ReadInt(std::string_view text, size_t &pos, int &value) {
+  while (pos < text.size() && IsSpace(text[pos])) {
+    ++pos;
+  }
+  bool negative = false;
+  if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+    negative = text[pos] == '-';
+    ++pos;
+  }
+  if (pos == text.size() || !IsDigit(text[pos])) {
+    value = 0;
+    return false;
+  }
+  long long result = 0;
+  bool overflow = false;
+  for (; pos < text.size() && IsDigit(text[pos]); ++pos) {
+    result = result * 10 + (text[pos] - '0');
+    if (result > static_cast<long long>(INT_MAX) + 1) {
+      overflow = true;
+      result = static_cast<long long>(INT_MAX) + 1;
     }
   }
-  std::string tail;
-  if (ss >> tail) {
-    throw std::invalid_argument("Wrong date format: " + date);
+  if (negative) {
+    result = -result;
   }
-}
-int Date::GetYear() const { return year; };
-int Date::GetMonth() const { return month; };
-int Date::GetDay() const { return day; };
-std::string Date::getDate() const {
-  std::stringstream stream;
-  stream << std::setw(4) << std::setfill('0') << year << "-" << std::setw(2)
-         << std::setfill('0') << month << "-" << std::setw(2)
-         << std::setfill('0') << day;
-  return stream.str();
+  if (overflow || result > INT_MAX || result < INT_MIN) {
+    value = negative ? INT_MIN : INT_MAX;
+    return false;
+  }
+  value = static_cast<int>(result);
+  return true;
 }
 
-bool operator<(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} <
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
-};
-bool operator<=(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} <=
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
-}
-bool operator>(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} >
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
+char *WritePadded(char *out, int value, size_t width) {
+  if (0 <= value && value < 100 && width == 2) {
+    out[0] = kDigitPairs.data[2 * value];
+    out[1] = kDigitPairs.data[2 * value + 1];
+    return out + 2;
+  }
+  if (0 <= value && value < 10000 && width == 4) {
+    out[0] = kDigitPairs.data[2 * (value / 100)];
+    out[1] = kDigitPairs.data[2 * (value / 100) + 1];
+    out[2] = kDigitPairs.data[2 * (value % 100)];
+    out[3] = kDigitPairs.data[2 * (value % 100) + 1];
+    return out + 4;
+  }
+  // Same as setw(width) << setfill('0'): zeros go in front of the sign.
+  const std::string digits = std::to_string(value);
+  for (size_t i = digits.size(); i < width; ++i) {
+    *out++ = '0';
+  }
+  for (char c : digits) {
+    *out++ = c;
+  }
+  return out;
 }
-bool operator>=(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} >=
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
+} // namespace
+
+Date::Date(std::string &date) { *this = ParseDate(date); }
+
+void Date::CheckDate(const std::string &date) { ParseDate(date); }
+std::string Date::getDate() const {
+  char buffer[kMaxDateLength];
+  return {buffer, WriteDate(buffer, *this)};
 }
-bool operator==(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} ==
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
+
+std::ostream &operator<<(std::ostream &stream, const Date &date) {
+  char buffer[kMaxDateLength];
+  return stream.write(buffer, WriteDate(buffer, date) - buffer);
 }
-bool operator!=(const Date &lhs, const Date &rhs) {
-  return std::vector<int>{lhs.GetYear(), lhs.GetMonth(), lhs.GetDay()} !=
-         std::vector<int>{rhs.GetYear(), rhs.GetMonth(), rhs.GetDay()};
+char *WriteDate(char *out, const Date &date) {
+  out = WritePadded(out, date.GetYear(), 4);
+  *out++ = '-';
+  out = WritePadded(out, date.GetMonth(), 2);
+  *out++ = '-';
+  return WritePadded(out, date.GetDay(), 2);
 }
-std::ostream &operator<<(std::ostream &stream, const Date &date) {
-  stream << std::setw(4) << std::setfill('0') << date.GetYear() << "-"
-         << std::setw(2) << std::setfill('0') << date.GetMonth() << "-"
-         << std::setw(2) << std::setfill('0') << date.GetDay();
-  return stream;
+Date ParseDate(std::string_view date) {
+  size_t pos = 0;
+  int year, month, day;
+  if (!ReadInt(date, pos, year) || pos == date.size() || date[pos] != '-') {
+    throw std::runtime_error("Wrong date format: " + std::string(date));
+  }
+  ++pos;
+  if (!ReadInt(date, pos, month) || pos == date.size() || date[pos] != '-') {
+    throw std::runtime_error("Wrong date format: " + std::string(date));
+  }
+  if (month < 1 || 12 < month) {
+    throw std::runtime_error("Month value is invalid: " +
+                             std::to_string(month));
+  }
+  ++pos;
+  const bool has_day = ReadInt(date, pos, day);
+  if (day < 1 || 31 < day) {
+    throw std::runtime_error("Day value is invalid: " + std::to_string(day));
+  }
+  while (has_day && pos < date.size() && IsSpace(date[pos])) {
+    ++pos;
+  }
+  if (has_day && pos != date.size()) {
+    throw std::invalid_argument("Wrong date format: " + std::string(date));
+  }
+  if (year < -kMaxYear || kMaxYear < year) {
+    throw std::runtime_error("Year value is invalid: " + std::to_string(year));
+  }
+  return {year, month, day};
 }
 Date ParseDate(std::istream &is) {
   std::string str;
   is >> str;
-  return Date(str);
+  return ParseDate(str);
 }
@@ -1,34 +1,68 @@
 #pragma once
-#include <iomanip>
+#include <cstdint>
 #include <ostream>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+
+// Longest text WriteDate can produce, e.g. "-2147483648-12-31".
+constexpr size_t kMaxDateLength = 32;
+// Widest year magnitude that still fits the packed key.
+constexpr int kMaxYear = 4'000'000;
+
 class Date {
 public:
-  Date() = default;
+  constexpr Date() = default;
   Date(std::string &date);
-  Date(int Year, int Month, int Day);
+  constexpr Date(int Year, int Month, int Day)
+      : key(Year * 512 + Month * 32 + Day) {}
 
   void CheckDate(const std::string &date);
-  int GetYear() const;
-  int GetMonth() const;
-  int GetDay() const;
+  constexpr int GetYear() const { return key >> 9; }
+  constexpr int GetMonth() const { return (key >> 5) & 15; }
+  constexpr int GetDay() const { return key & 31; }
+  // year * 512 + month * 32 + day: keys order exactly like (year, month, day)
+  constexpr int32_t GetKey() const { return key; }
+  // Any key is a valid bound for ordered lookups, even between real dates.
+  static constexpr Date FromKey(int32_t key) {
+    Date date;
+    date.key = key;
+    return date;
+  }
+  static constexpr Date Min() { return FromKey(INT32_MIN); }
+  static constexpr Date Max() { return FromKey(INT32_MAX); }
   std::string getDate() const;
 
 private:
-  int year;
-  int month;
-  int day;
+  int32_t key = 0;
 };
 
-bool operator<(const Date &lhs, const Date &rhs);
-bool operator<=(const Date &lhs, const Date &rhs);
-bool operator>(const Date &lhs, const Date &rhs);
-bool operator>=(const Date &lhs, const Date &rhs);
-bool operator==(const Date &lhs, const Date &rhs);
-bool operator!=(const Date &lhs, const Date &rhs);
+constexpr bool operator<(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() < rhs.GetKey();
+}
+constexpr bool operator<=(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() <= rhs.GetKey();
+}
+constexpr bool operator>(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() > rhs.GetKey();
+}
+constexpr bool operator>=(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() >= rhs.GetKey();
+}
+constexpr bool operator==(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() == rhs.GetKey();
+}
+constexpr bool operator!=(const Date &lhs, const Date &rhs) {
+  return lhs.GetKey() != rhs.GetKey();
+}
 
 std::ostream &operator<<(std::ostream &stream, const Date &date);
 
-Date ParseDate(std::istream &is);
\ No newline at end of file
+// Validates and decodes "Y-M-D" in one pass, throwing the same errors as
+// Date::CheckDate.
+Date ParseDate(std::string_view date);
+Date ParseDate(std::istream &is);
+
+// Writes YYYY-MM-DD into `out` (at least kMaxDateLength chars) and returns
+// the end of the written text.
+char *WriteDate(char *out, const Date &date);
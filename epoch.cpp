@@ -0,0 +1,88 @@
+#include "epoch.h"
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+EpochManager::Guard &EpochManager::Guard::operator=(Guard &&other) noexcept {
+  if (this != &other) {
+    Release();
+    slot_ = other.slot_;
+    other.slot_ = nullptr;
+  }
+  return *this;
+}
+
+void EpochManager::Guard::Release() {
+  if (slot_ != nullptr) {
+    slot_->store(kIdle);
+    slot_ = nullptr;
+  }
+}
+
+EpochManager::SlotBlock::SlotBlock() {
+  for (auto &slot : slots) {
+    slot.store(kIdle);
+  }
+}
+
+EpochManager::EpochManager() = default;
+
+EpochManager::~EpochManager() {
+  for (Retired &retired : retired_) {
+    retired.reclaim();
+  }
+  for (SlotBlock *block = slots_.next; block != nullptr;) {
+    SlotBlock *next = block->next;
+    delete block;
+    block = next;
+  }
+}
+
+EpochManager::Guard EpochManager::Pin() {
+  // Starting from a different slot per thread keeps readers apart.
+  const size_t start = hash<thread::id>()(this_thread::get_id()) % kSlots;
+  for (SlotBlock *block = &slots_;;) {
+    for (size_t j = 0; j < kSlots; ++j) {
+      auto &slot = block->slots[(start + j) % kSlots];
+      uint64_t idle = kIdle;
+      // The epoch is read before whatever the reader loads next, so
+      // anything that reader can reach was retired in this epoch or later.
+      if (slot.load(memory_order_relaxed) == kIdle &&
+          slot.compare_exchange_strong(idle, epoch_.load())) {
+        return Guard(&slot);
+      }
+    }
+    SlotBlock *next = block->next.load();
+    if (next == nullptr) {
+      // Every slot is taken: add a block, unless another reader just did.
+      auto added = make_unique<SlotBlock>();
+      if (block->next.compare_exchange_strong(next, added.get())) {
+        next = added.release();
+      }
+    }
+    block = next;
+  }
+}
+
+void EpochManager::Retire(function<void()> reclaim) {
+  // The change is published, so readers pinned from the next epoch on
+  // can't see what was unlinked.
+  retired_.push_back({epoch_.fetch_add(1), move(reclaim)});
+}
+
+void EpochManager::Collect() {
+  uint64_t oldest = epoch_.load();
+  for (const SlotBlock *block = &slots_; block != nullptr;
+       block = block->next.load()) {
+    for (const auto &slot : block->slots) {
+      oldest = min(oldest, slot.load());
+    }
+  }
+  size_t freed = 0;
+  for (; freed < retired_.size() && retired_[freed].epoch < oldest; ++freed) {
+    retired_[freed].reclaim();
+  }
+  retired_.erase(retired_.begin(), retired_.begin() + freed);
+}
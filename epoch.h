@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Epoch-based reclamation for structures that readers walk without locks.
+// A reader pins the current epoch before loading a pointer and unpins when
+// done. A writer that unlinks an object retires it; it is freed once every
+// reader pinned at or before the epoch it was retired in has unpinned.
+class EpochManager {
+public:
+  // Readers pinned at once that share one block of slots. Pin adds
+  // another block when all are taken; blocks stay until destruction.
+  static constexpr size_t kSlots = 64;
+
+  class Guard {
+  public:
+    Guard(Guard &&other) noexcept : slot_(other.slot_) {
+      other.slot_ = nullptr;
+    }
+    Guard &operator=(Guard &&other) noexcept;
+    ~Guard() { Release(); }
+
+  private:
+    friend class EpochManager;
+    explicit Guard(std::atomic<uint64_t> *slot) : slot_(slot) {}
+    void Release();
+
+    std::atomic<uint64_t> *slot_;
+  };
+
+  EpochManager();
+  // Frees everything still retired; no reader may be pinned.
+  ~EpochManager();
+  EpochManager(const EpochManager &) = delete;
+  EpochManager &operator=(const EpochManager &) = delete;
+
+  // Lock-free; allocates only when every slot is taken.
+  Guard Pin();
+  // For writers, serialized among themselves. `reclaim` frees what the
+  // writer has just unlinked; call it after publishing the change.
+  void Retire(std::function<void()> reclaim);
+  // Frees whatever no pinned reader can still see.
+  void Collect();
+  size_t GetRetiredCount() const { return retired_.size(); }
+
+private:
+  static constexpr uint64_t kIdle = UINT64_MAX;
+
+  struct Retired {
+    uint64_t epoch;
+    std::function<void()> reclaim;
+  };
+  struct SlotBlock {
+    SlotBlock();
+
+    std::array<std::atomic<uint64_t>, kSlots> slots;
+    // Only ever set once, from null.
+    std::atomic<SlotBlock *> next{nullptr};
+  };
+
+  std::atomic<uint64_t> epoch_{0};
+  SlotBlock slots_;
+  // In retirement order, so in epoch order.
+  std::vector<Retired> retired_;
+};
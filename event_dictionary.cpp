@@ -0,0 +1,103 @@
+#include "event_dictionary.h"
+#include <algorithm>
+#include <mutex>
+
+EventId EventDictionary::Intern(std::string_view event) {
+  auto it = ids_.find(event);
+  if (it != ids_.end()) {
+    return it->second;
+  }
+  const EventId id = size_;
+  const auto [segment, offset] = Locate(id);
+  if (segments_[segment] == nullptr) {
+    segments_[segment] =
+        std::make_unique<std::string[]>(kFirstSegment << segment);
+  }
+  std::string &name = segments_[segment][offset];
+  name = event;
+  ids_.emplace(name, id);
+  ++size_;
+  return id;
+}
+
+EventId EventDictionary::Find(std::string_view event) const {
+  auto it = ids_.find(event);
+  return it == ids_.end() ? kNoEvent : it->second;
+}
+
+void EventDictionary::SortRanks() {
+  if (RanksSorted()) {
+    return;
+  }
+  auto by_name = [this](EventId lhs, EventId rhs) {
+    return Name(lhs) < Name(rhs);
+  };
+  auto table = std::make_shared<RankTable>();
+  std::vector<EventId> &sorted = table->sorted;
+  const size_t sorted_count = ranks_->sorted.size();
+  sorted.reserve(size_);
+  sorted.assign(ranks_->sorted.begin(), ranks_->sorted.end());
+  for (EventId id = sorted_count; id < size_; ++id) {
+    sorted.push_back(id);
+  }
+  std::sort(sorted.begin() + sorted_count, sorted.end(), by_name);
+  std::inplace_merge(sorted.begin(), sorted.begin() + sorted_count,
+                     sorted.end(), by_name);
+  table->ranks.resize(size_);
+  for (uint32_t rank = 0; rank < sorted.size(); ++rank) {
+    table->ranks[sorted[rank]] = rank;
+  }
+  ranks_ = std::move(table);
+}
+
+EventId EventDictionary::Find(const RankTable &table,
+                              std::string_view event) const {
+  const uint32_t rank = RankLowerBound(table, event);
+  if (rank == table.sorted.size() || Name(table.sorted[rank]) != event) {
+    return kNoEvent;
+  }
+  return table.sorted[rank];
+}
+
+uint32_t EventDictionary::RankLowerBound(const RankTable &table,
+                                         std::string_view event) const {
+  const std::vector<EventId> &sorted = table.sorted;
+  return std::lower_bound(sorted.begin(), sorted.end(), event,
+                          [this](EventId id, std::string_view value) {
+                            return Name(id) < value;
+                          }) -
+         sorted.begin();
+}
+
+uint32_t EventDictionary::RankUpperBound(const RankTable &table,
+                                         std::string_view event) const {
+  const std::vector<EventId> &sorted = table.sorted;
+  return std::upper_bound(sorted.begin(), sorted.end(), event,
+                          [this](std::string_view value, EventId id) {
+                            return value < Name(id);
+                          }) -
+         sorted.begin();
+}
+
+EventDictionary &GetEventDictionary() {
+  static EventDictionary dictionary;
+  return dictionary;
+}
+
+std::shared_mutex &GetEventDictionaryMutex() {
+  static std::shared_mutex mutex;
+  return mutex;
+}
+
+std::shared_lock<std::shared_mutex> LockEventDictionary() {
+  auto &dictionary = GetEventDictionary();
+  while (true) {
+    std::shared_lock<std::shared_mutex> lock(GetEventDictionaryMutex());
+    if (dictionary.RanksSorted()) {
+      return lock;
+    }
+    lock.unlock();
+    std::unique_lock<std::shared_mutex> exclusive(GetEventDictionaryMutex());
+    dictionary.SortRanks();
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using EventId = uint32_t;
+constexpr EventId kNoEvent = UINT32_MAX;
+
+// Interns event names so the database stores 32-bit ids. Besides the id the
+// dictionary can give the rank of a name in string order, which lets ordered
+// comparisons run on integers. Ranks are refreshed by SortRanks, so a scan
+// that uses them must call it after the last Intern.
+class EventDictionary {
+public:
+  // Ids in string order and the position of every id in it, as of one
+  // SortRanks. A published table never changes, so a bound condition keeps
+  // using its own while later names get sorted into a new one.
+  struct RankTable {
+    std::vector<EventId> sorted;
+    std::vector<uint32_t> ranks;
+  };
+
+  EventId Intern(std::string_view event);
+  // kNoEvent if the name was never interned.
+  EventId Find(std::string_view event) const;
+  // Safe to call while another thread interns: names never move.
+  const std::string &Name(EventId id) const {
+    const auto [segment, offset] = Locate(id);
+    return segments_[segment][offset];
+  }
+  size_t Size() const { return size_; }
+
+  void SortRanks();
+  bool RanksSorted() const { return ranks_->sorted.size() == size_; }
+  std::shared_ptr<const RankTable> GetRanks() const { return ranks_; }
+  uint32_t Rank(EventId id) const { return ranks_->ranks[id]; }
+  // Number of interned names less than `event`.
+  uint32_t RankLowerBound(std::string_view event) const {
+    return RankLowerBound(*ranks_, event);
+  }
+  // Number of interned names less than or equal to `event`.
+  uint32_t RankUpperBound(std::string_view event) const {
+    return RankUpperBound(*ranks_, event);
+  }
+  // The same over the names a table taken earlier holds. They only read
+  // those names, so they need no lock while others intern.
+  EventId Find(const RankTable &table, std::string_view event) const;
+  uint32_t RankLowerBound(const RankTable &table,
+                          std::string_view event) const;
+  uint32_t RankUpperBound(const RankTable &table,
+                          std::string_view event) const;
+
+private:
+  // Segment k holds kFirstSegment << k names and is allocated when the
+  // first of them is interned.
+  static constexpr size_t kFirstSegment = 64;
+  static std::pair<size_t, size_t> Locate(EventId id) {
+    const uint64_t slot = id / kFirstSegment + 1;
+    const size_t segment = 63 - __builtin_clzll(slot);
+    return {segment, id - kFirstSegment * ((uint64_t{1} << segment) - 1)};
+  }
+
+  std::array<std::unique_ptr<std::string[]>, 27> segments_;
+  size_t size_ = 0;
+  // Views into the segments.
+  std::unordered_map<std::string_view, EventId> ids_;
+  std::shared_ptr<const RankTable> ranks_ = std::make_shared<RankTable>();
+};
+
+EventDictionary &GetEventDictionary();
+// The dictionary itself is not synchronized. Code that uses it from several
+// threads, like ShardedDatabase, holds this lock: shared to read, with the
+// ranks sorted, and exclusive to intern a name or sort the ranks. Name and
+// a RankTable already taken need no lock.
+std::shared_mutex &GetEventDictionaryMutex();
+// Locks the dictionary shared once its ranks are sorted, so that conditions
+// can be bound under the lock.
+std::shared_lock<std::shared_mutex> LockEventDictionary();
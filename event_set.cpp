@@ -0,0 +1,57 @@
+#include "event_set.h"
+#include <algorithm>
+
+bool EventSet::Add(EventId event) {
+  if (Find(event) >= 0) {
+    return false;
+  }
+  events_.push_back(event);
+  if (events_.size() > kLinearLimit) {
+    if (slots_.size() < 2 * events_.size()) {
+      RebuildIndex();
+    } else {
+      Insert(events_.size() - 1);
+    }
+  }
+  return true;
+}
+
+int64_t EventSet::Find(EventId event) const {
+  if (slots_.empty()) {
+    auto it = std::find(events_.begin(), events_.end(), event);
+    return it == events_.end() ? -1 : it - events_.begin();
+  }
+  const size_t mask = slots_.size() - 1;
+  for (size_t slot = Hash(event) & mask; slots_[slot] != 0;
+       slot = (slot + 1) & mask) {
+    if (events_[slots_[slot] - 1] == event) {
+      return slots_[slot] - 1;
+    }
+  }
+  return -1;
+}
+
+void EventSet::Insert(uint32_t position) {
+  const size_t mask = slots_.size() - 1;
+  size_t slot = Hash(events_[position]) & mask;
+  while (slots_[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = position + 1;
+}
+
+void EventSet::RebuildIndex() {
+  slots_.clear();
+  if (events_.size() <= kLinearLimit) {
+    slots_.shrink_to_fit();
+    return;
+  }
+  size_t capacity = 16;
+  while (capacity < 4 * events_.size()) {
+    capacity *= 2;
+  }
+  slots_.assign(capacity, 0);
+  for (size_t i = 0; i < events_.size(); ++i) {
+    Insert(i);
+  }
+}
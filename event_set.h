@@ -0,0 +1,56 @@
+#pragma once
+#include "event_dictionary.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Event ids of one date in insertion order. Small sets dedup with a linear
+// scan, larger ones keep an open-addressing table of positions on top of
+// the ordered vector.
+class EventSet {
+public:
+  EventSet() = default;
+  // Takes distinct events in insertion order and indexes them at once.
+  explicit EventSet(std::vector<EventId> events) : events_(std::move(events)) {
+    RebuildIndex();
+  }
+
+  // Returns false if the event is already present.
+  bool Add(EventId event);
+  bool Contains(EventId event) const { return Find(event) >= 0; }
+
+  const std::vector<EventId> &GetAll() const { return events_; }
+  size_t Size() const { return events_.size(); }
+  bool Empty() const { return events_.empty(); }
+
+  // Drops every event the predicate accepts, keeping the order of the rest.
+  // Returns how many events were removed.
+  template <typename Predicate> int RemoveIf(Predicate predicate) {
+    size_t kept = 0;
+    for (size_t i = 0; i < events_.size(); ++i) {
+      if (!predicate(events_[i])) {
+        events_[kept++] = events_[i];
+      }
+    }
+    const int removed = static_cast<int>(events_.size() - kept);
+    if (removed > 0) {
+      events_.resize(kept);
+      RebuildIndex();
+    }
+    return removed;
+  }
+
+private:
+  static constexpr size_t kLinearLimit = 8;
+
+  static size_t Hash(EventId event) { return event * 2654435761u; }
+  // Position of the event or -1.
+  int64_t Find(EventId event) const;
+  void Insert(uint32_t position);
+  void RebuildIndex();
+
+  std::vector<EventId> events_;
+  // Position + 1 of an event per slot, 0 for an empty slot; empty while the
+  // set is small enough for a linear scan.
+  std::vector<uint32_t> slots_;
+};
@@ -0,0 +1,98 @@
+#include "line_reader.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <unistd.h>
+
+LineReader::LineReader(std::FILE *input, size_t block_size)
+    : input_(input), buffer_(block_size) {
+  if (pipe2(wake_, O_CLOEXEC) != 0) {
+    throw std::runtime_error("Can't create a pipe");
+  }
+}
+
+LineReader::~LineReader() {
+  close(wake_[0]);
+  close(wake_[1]);
+}
+
+void LineReader::Interrupt() {
+  interrupted_ = true;
+  const char byte = 0;
+  // The pipe only has to become readable; a full one already is.
+  while (write(wake_[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+}
+
+bool LineReader::Next(std::string_view &line) {
+  if (interrupted_) {
+    return false;
+  }
+  size_t scanned = begin_;
+  while (true) {
+    const void *newline =
+        std::memchr(buffer_.data() + scanned, '\n', end_ - scanned);
+    if (newline != nullptr) {
+      const char *stop = static_cast<const char *>(newline);
+      line = std::string_view(buffer_.data() + begin_,
+                              stop - (buffer_.data() + begin_));
+      begin_ = stop - buffer_.data() + 1;
+      return true;
+    }
+    const size_t pending = end_ - begin_;
+    if (!Fill()) {
+      if (pending == 0 || interrupted_) {
+        return false;
+      }
+      line = std::string_view(buffer_.data() + begin_, pending);
+      begin_ = end_;
+      return true;
+    }
+    // Fill moved the pending bytes to the front; they have no newline.
+    scanned = pending;
+  }
+}
+
+bool LineReader::Fill() {
+  if (eof_) {
+    return false;
+  }
+  const size_t pending = end_ - begin_;
+  if (begin_ > 0) {
+    std::memmove(buffer_.data(), buffer_.data() + begin_, pending);
+    begin_ = 0;
+    end_ = pending;
+  }
+  if (end_ == buffer_.size()) {
+    buffer_.resize(buffer_.size() * 2);
+  }
+  pollfd fds[] = {{fileno(input_), POLLIN, 0}, {wake_[0], POLLIN, 0}};
+  while (true) {
+    if (interrupted_) {
+      return false;
+    }
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents != 0) {
+      return false;
+    }
+    const ssize_t result =
+        read(fileno(input_), buffer_.data() + end_, buffer_.size() - end_);
+    if (result < 0 && (errno == EINTR || errno == EAGAIN)) {
+      continue;
+    }
+    if (result > 0) {
+      end_ += result;
+      return true;
+    }
+    break;
+  }
+  eof_ = true;
+  return false;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+// Reads a file in large blocks and hands out its lines as views into the
+// block, without copying them or going through iostreams. Lines end at
+// '\n', which is not part of the view; a last line without one is still
+// returned, like getline does. A read returns whatever input is there, so
+// lines from a pipe or a terminal come out as they arrive.
+class LineReader {
+public:
+  static constexpr size_t kBlockSize = 1 << 20;
+
+  explicit LineReader(std::FILE *input, size_t block_size = kBlockSize);
+  ~LineReader();
+  LineReader(const LineReader &) = delete;
+  LineReader &operator=(const LineReader &) = delete;
+
+  // Returns false at the end of input or once interrupted. The view is
+  // valid until the next call.
+  bool Next(std::string_view &line);
+  // Makes Next return false from now on, also a call on another thread
+  // that waits for input.
+  void Interrupt();
+
+private:
+  // Moves the unread tail to the front and reads more after it. Returns
+  // false if nothing more could be read.
+  bool Fill();
+
+  std::FILE *input_;
+  std::vector<char> buffer_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  bool eof_ = false;
+  std::atomic<bool> interrupted_{false};
+  // Interrupt writes to the pipe to wake a read waiting in poll.
+  int wake_[2];
+};
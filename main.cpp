@@ -1,10 +1,30 @@
+#include "compactor.h"
 #include "condition_parser.h"
 #include "database.h"
 #include "date.h"
+#include "line_reader.h"
+#include "output_buffer.h"
+#include "sharded_database.h"
+#include "snapshot.h"
+#include "spsc_queue.h"
+#include "thread_pool.h"
+#include "token.h"
+#include "versioned_database.h"
+#include "wal.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 using namespace std;
 #include "test_runner.h"
@@ -12,59 +32,442 @@ using namespace std;
 string ParseEvent(istream &is) {
   std::string tmp;
   getline(is, tmp);
-  while (*tmp.begin() == ' ')
-    tmp.erase(tmp.begin());
+  tmp.erase(0, min(tmp.find_first_not_of(' '), tmp.size()));
   return tmp;
 }
 
-void TestAll();
+// The rest of the line without its leading spaces, like ParseEvent above.
+string_view ParseEvent(string_view line) {
+  line.remove_prefix(min(line.find_first_not_of(' '), line.size()));
+  return line;
+}
 
-int main() {
-  // TestAll();
+bool IsSpace(char c) { return c == ' ' || ('\t' <= c && c <= '\r'); }
 
-  Database db;
+// Splits off the next whitespace-separated word, like `is >> word`.
+string_view NextWord(string_view &line) {
+  size_t begin = 0;
+  while (begin < line.size() && IsSpace(line[begin])) {
+    ++begin;
+  }
+  size_t end = begin;
+  while (end < line.size() && !IsSpace(line[end])) {
+    ++end;
+  }
+  const string_view word = line.substr(begin, end - begin);
+  line.remove_prefix(end);
+  return word;
+}
 
-  for (string line; getline(cin, line);) {
-    istringstream is(line);
+// Print, Find and Last that reach a damaged chunk of an opened snapshot
+// answer with the error, after any entries read before it, and the session
+// goes on.
+void ExecuteCommand(string_view line, Database &db, OutputBuffer &out) {
+  const string_view command = NextWord(line);
+  if (command == "Add") {
+    const auto date = ParseDate(NextWord(line));
+    db.Add(date, ParseEvent(line));
+  } else if (command == "Print") {
+    try {
+      db.Print(out);
+    } catch (CorruptSnapshot &e) {
+      out << e.what() << '\n';
+    }
+  } else if (command == "Del") {
+    int count = db.RemoveIf(ParseQuery(line));
+    out << "Removed " << count << " entries\n";
+  } else if (command == "Find") {
+    const Query query = ParseQuery(line);
+    try {
+      const int count =
+          db.ForEachIf(query, [&out](const Date &date, string_view event) {
+            out << date << ' ' << event << '\n';
+          });
+      out << "Found " << count << " entries\n";
+    } catch (CorruptSnapshot &e) {
+      out << e.what() << '\n';
+    }
+  } else if (command == "Last") {
+    try {
+      out << db.Last(ParseDate(NextWord(line))) << '\n';
+    } catch (invalid_argument &) {
+      out << "No entries\n";
+    } catch (CorruptSnapshot &e) {
+      out << e.what() << '\n';
+    }
+  } else if (command == "Save") {
+    db.Save(string(ParseEvent(line)));
+  } else if (command == "Export") {
+    db.Save(string(ParseEvent(line)), SnapshotEncoding::Compressed);
+  } else if (command == "Load") {
+    db.Load(string(ParseEvent(line)));
+  } else if (command == "Open") {
+    db.Open(string(ParseEvent(line)));
+  } else if (command == "Checkpoint") {
+    db.Checkpoint();
+  } else if (command == "Stats") {
+    if (const Compactor *compactor = db.GetCompactor()) {
+      const CompactionMetrics metrics = compactor->GetMetrics();
+      out << "Log size: " << static_cast<long long>(compactor->GetLogSize())
+          << " bytes\n"
+          << "Compactions: " << static_cast<long long>(metrics.compactions)
+          << '\n'
+          << "Last compaction: "
+          << static_cast<long long>(metrics.last_capture.count())
+          << " us capture, "
+          << static_cast<long long>(metrics.last_write.count())
+          << " us write, "
+          << static_cast<long long>(metrics.last_snapshot_events)
+          << " events\n"
+          << "Total compaction time: "
+          << static_cast<long long>(metrics.total_write.count()) << " us\n";
+      if (!metrics.error.empty()) {
+        out << "Compaction failed: " << metrics.error << '\n';
+      }
+    }
+  } else if (!command.empty()) {
+    throw logic_error("Unknown command: " + string(command));
+  }
+}
 
-    string command;
-    is >> command;
-    if (command == "Add") {
-      const auto date = ParseDate(is);
-      const auto event = ParseEvent(is);
-      db.Add(date, event);
-    } else if (command == "Print") {
-      db.Print(cout);
-    } else if (command == "Del") {
-      auto condition = ParseCondition(is);
-      auto predicate = [condition](const Date &date, const string &event) {
-        return condition->Evaluate(date, event);
-      };
-      int count = db.RemoveIf(predicate);
-      cout << "Removed " << count << " entries" << endl;
-    } else if (command == "Find") {
-      auto condition = ParseCondition(is);
-      auto predicate = [condition](const Date &date, const string &event) {
-        return condition->Evaluate(date, event);
-      };
-
-      const auto entries = db.FindIf(predicate);
-      for (const auto &entry : entries) {
-        cout << entry << endl;
+// Imports lines of "date event", as Print writes them, with one BulkLoad.
+void BulkLoadFile(const string &path, Database &db) {
+  const vector<char> data = ReadFile(path);
+  vector<pair<Date, string_view>> entries;
+  string_view rest(data.data(), data.size());
+  while (!rest.empty()) {
+    const size_t end = min(rest.find('\n'), rest.size());
+    string_view line = rest.substr(0, end);
+    rest.remove_prefix(min(end + 1, rest.size()));
+    const string_view date = NextWord(line);
+    if (!date.empty()) {
+      entries.emplace_back(ParseDate(date), ParseEvent(line));
+    }
+  }
+  db.BulkLoad(entries);
+}
+
+// A line taken apart by the parser stage of RunPipeline. The commands that
+// are common or costly to parse get fields of their own; any other line is
+// kept whole for ExecuteCommand.
+struct ParsedCommand {
+  enum class Kind { Add, Find, Del, Print, Other, Error, End };
+
+  Kind kind = Kind::End;
+  Date date;
+  // The event of Add or the whole line of Other.
+  string text;
+  // Of Find, Del and Print.
+  Query query;
+  exception_ptr error;
+};
+
+// What a command of RunPipeline answered, formatted by its output stage.
+struct CommandOutput {
+  enum class Kind { Entries, Found, Removed, Text, Error, End };
+
+  Kind kind = Kind::End;
+  // Print and Find; the views stay valid for the process's lifetime.
+  vector<pair<Date, string_view>> entries;
+  int count = 0;
+  string text;
+  exception_ptr error;
+};
+
+ParsedCommand ParseCommand(string_view line) {
+  using Kind = ParsedCommand::Kind;
+  ParsedCommand command;
+  string_view rest = line;
+  const string_view word = NextWord(rest);
+  if (word == "Add") {
+    command.kind = Kind::Add;
+    command.date = ParseDate(NextWord(rest));
+    command.text = ParseEvent(rest);
+  } else if (word == "Find" || word == "Del") {
+    command.kind = word == "Find" ? Kind::Find : Kind::Del;
+    command.query = ParseQuery(rest);
+  } else if (word == "Print") {
+    // Every entry, in Print order.
+    command.kind = Kind::Print;
+    command.query = ParseQuery("");
+  } else {
+    command.kind = Kind::Other;
+    command.text = line;
+  }
+  return command;
+}
+
+// Find and Print hand their entries to the output stage in batches of this
+// many, so a large result never sits in memory whole: at most the queue's
+// capacity of batches waits to be written.
+constexpr size_t kBatchEntries = 256;
+
+// Runs `command` and passes what it answered, in order, to
+// emit(CommandOutput &): the entries of Find and Print in batches of up to
+// kBatchEntries, then the rest.
+template <typename Emit>
+void RunCommand(ParsedCommand &command, Database &db, Emit emit) {
+  using Kind = ParsedCommand::Kind;
+  CommandOutput output;
+  auto collect = [&output, &emit](const Date &date, string_view event) {
+    output.entries.emplace_back(date, event);
+    if (output.entries.size() == kBatchEntries) {
+      CommandOutput batch;
+      batch.kind = CommandOutput::Kind::Entries;
+      batch.entries.swap(output.entries);
+      emit(batch);
+    }
+  };
+  switch (command.kind) {
+  case Kind::Add:
+    db.Add(command.date, command.text);
+    output.kind = CommandOutput::Kind::Text;
+    break;
+  case Kind::Find:
+  case Kind::Print:
+    output.kind = command.kind == Kind::Find ? CommandOutput::Kind::Found
+                                             : CommandOutput::Kind::Entries;
+    try {
+      output.count = db.ForEachIf(command.query, collect);
+    } catch (CorruptSnapshot &e) {
+      // Answered like ExecuteCommand does.
+      output.kind = CommandOutput::Kind::Text;
+      output.text = string(e.what()) + '\n';
+    }
+    break;
+  case Kind::Del:
+    output.kind = CommandOutput::Kind::Removed;
+    output.count = db.RemoveIf(command.query);
+    break;
+  case Kind::Other: {
+    ostringstream text;
+    {
+      OutputBuffer out(text);
+      ExecuteCommand(command.text, db, out);
+    }
+    output.kind = CommandOutput::Kind::Text;
+    output.text = text.str();
+    break;
+  }
+  case Kind::Error:
+    rethrow_exception(command.error);
+  case Kind::End:
+    break;
+  }
+  emit(output);
+}
+
+void WriteOutput(const CommandOutput &output, OutputBuffer &out) {
+  for (const auto &[date, event] : output.entries) {
+    out << date << ' ' << event << '\n';
+  }
+  if (output.kind == CommandOutput::Kind::Found) {
+    out << "Found " << output.count << " entries\n";
+  } else if (output.kind == CommandOutput::Kind::Removed) {
+    out << "Removed " << output.count << " entries\n";
+  } else {
+    out << output.text;
+  }
+}
+
+// Runs every line like ExecuteCommand does, with the same output, on three
+// threads: this one formats the output, one parses the lines and one
+// executes them in order. A line that fails stops the pipeline once all
+// before it are written, and its exception is rethrown here.
+void RunPipeline(LineReader &reader, Database &db, OutputBuffer &out) {
+  constexpr size_t kQueueSize = 1024;
+  SpscQueue<ParsedCommand> commands(kQueueSize);
+  SpscQueue<CommandOutput> outputs(kQueueSize);
+  // Set to stop the parser and the executor's wait for commands, or also
+  // the executor's wait for room for output.
+  atomic<bool> cancelled{false}, abandoned{false};
+  auto cancel = [&] {
+    cancelled = true;
+    reader.Interrupt();
+    commands.Wake();
+  };
+
+  thread parser, executor;
+  // However this returns, the stages are stopped and joined first.
+  struct Join {
+    function<void()> stop;
+    thread &parser, &executor;
+    ~Join() {
+      stop();
+      for (thread *stage : {&parser, &executor}) {
+        if (stage->joinable()) {
+          stage->join();
+        }
       }
-      cout << "Found " << entries.size() << " entries" << endl;
-    } else if (command == "Last") {
+    }
+  } join{[&] {
+           cancel();
+           abandoned = true;
+           outputs.Wake();
+         },
+         parser, executor};
+
+  parser = thread([&] {
+    for (string_view line; reader.Next(line);) {
+      ParsedCommand command;
       try {
-        cout << db.Last(ParseDate(is)) << endl;
-      } catch (invalid_argument &) {
-        cout << "No entries" << endl;
+        command = ParseCommand(line);
+      } catch (...) {
+        command.kind = ParsedCommand::Kind::Error;
+        command.error = current_exception();
+      }
+      const bool error = command.kind == ParsedCommand::Kind::Error;
+      if (!commands.Push(command, cancelled) || error) {
+        return;
+      }
+    }
+    ParsedCommand end;
+    commands.Push(end, cancelled);
+  });
+  executor = thread([&] {
+    // Thrown out of a command once its output can't be delivered.
+    struct Abandoned {};
+    auto emit = [&](CommandOutput &output) {
+      // Most commands, Add above all, have nothing to write.
+      if (output.kind == CommandOutput::Kind::Text && output.text.empty()) {
+        return;
+      }
+      if (!outputs.Push(output, abandoned)) {
+        throw Abandoned();
+      }
+    };
+    ParsedCommand command;
+    while (commands.Pop(command, cancelled) &&
+           command.kind != ParsedCommand::Kind::End) {
+      try {
+        RunCommand(command, db, emit);
+      } catch (Abandoned &) {
+        return;
+      } catch (...) {
+        CommandOutput output;
+        output.kind = CommandOutput::Kind::Error;
+        output.error = current_exception();
+        // No later line runs, so none needs to be read.
+        cancel();
+        outputs.Push(output, abandoned);
+        return;
+      }
+    }
+    CommandOutput end;
+    outputs.Push(end, abandoned);
+  });
+
+  for (CommandOutput output; outputs.Pop(output, abandoned);) {
+    if (output.kind == CommandOutput::Kind::End) {
+      break;
+    }
+    if (output.kind == CommandOutput::Kind::Error) {
+      rethrow_exception(output.error);
+    }
+    WriteOutput(output, out);
+  }
+}
+
+void TestAll();
+
+int main(int argc, char *argv[]) {
+  // TestAll();
+
+  Database db;
+  FILE *input = stdin;
+  string load_path, open_path, bulk_path, save_path, export_path, wal_path;
+  GroupCommitPolicy policy;
+  CompactionPolicy compaction;
+  bool pipeline = false;
+  for (int i = 1; i < argc; ++i) {
+    const string flag = argv[i];
+    if (flag == "--event-index") {
+      db.EnableEventIndex(true);
+    } else if (flag == "--pipeline") {
+      pipeline = true;
+    } else if (flag == "--load" && i + 1 < argc) {
+      load_path = argv[++i];
+    } else if (flag == "--open" && i + 1 < argc) {
+      open_path = argv[++i];
+    } else if (flag == "--bulk-load" && i + 1 < argc) {
+      bulk_path = argv[++i];
+    } else if (flag == "--save" && i + 1 < argc) {
+      save_path = argv[++i];
+    } else if (flag == "--export" && i + 1 < argc) {
+      export_path = argv[++i];
+    } else if (flag == "--wal" && i + 1 < argc) {
+      wal_path = argv[++i];
+    } else if (flag == "--sync-every" && i + 1 < argc) {
+      policy.max_records = stoul(argv[++i]);
+    } else if (flag == "--sync-delay-ms" && i + 1 < argc) {
+      policy.max_delay = chrono::milliseconds(stoul(argv[++i]));
+    } else if (flag == "--compact-bytes" && i + 1 < argc) {
+      compaction.max_log_bytes = stoull(argv[++i]);
+    } else if (flag == "--compact-interval-s" && i + 1 < argc) {
+      compaction.interval = chrono::seconds(stoul(argv[++i]));
+    } else if (flag == "--input" && i + 1 < argc) {
+      input = fopen(argv[++i], "rb");
+      if (input == nullptr) {
+        throw runtime_error("Can't open " + string(argv[i]));
       }
-    } else if (command.empty()) {
-      continue;
     } else {
-      throw logic_error("Unknown command: " + command);
+      throw logic_error("Unknown flag: " + flag);
     }
   }
+  // Recovery comes first, so that a snapshot given on top of it gets
+  // checkpointed into the log.
+  unique_ptr<WriteAheadLog> wal;
+  unique_ptr<Compactor> compactor;
+  if (!wal_path.empty()) {
+    const uint64_t valid_size = db.Recover(wal_path);
+    wal = make_unique<WriteAheadLog>(wal_path, valid_size, policy);
+    compactor = make_unique<Compactor>(*wal, compaction);
+    db.SetLog(wal.get());
+    db.SetCompactor(compactor.get());
+  }
+  if (!load_path.empty()) {
+    db.Load(load_path);
+  }
+  if (!open_path.empty()) {
+    db.Open(open_path);
+  }
+  if (!bulk_path.empty()) {
+    BulkLoadFile(bulk_path, db);
+  }
+
+  // Someone typing commands wants each answer at once; a replayed log only
+  // needs the output at the end.
+  const bool interactive = isatty(fileno(input));
+  ios::sync_with_stdio(false);
+  OutputBuffer out(cout);
+  LineReader reader(input);
+  try {
+    if (pipeline && !interactive) {
+      RunPipeline(reader, db, out);
+    }
+    for (string_view line; reader.Next(line);) {
+      ExecuteCommand(line, db, out);
+      if (interactive) {
+        // Nothing is answered before it is on disk.
+        if (wal) {
+          wal->Sync();
+        }
+        out.Flush();
+      }
+    }
+    if (!save_path.empty()) {
+      db.Save(save_path);
+    }
+    if (!export_path.empty()) {
+      db.Save(export_path, SnapshotEncoding::Compressed);
+    }
+  } catch (...) {
+    if (wal) {
+      wal->Sync();
+    }
+    out.Flush();
+    throw;
+  }
 
   return 0;
 }
@@ -87,8 +490,203 @@ void TestParseEvent() {
     AssertEqual(events, vector<string>{"first event  ", "second event"},
                 "Parse multiple events");
   }
+  {
+    string_view line = "  Add\t2017-01-01   sport event ";
+    AssertEqual(NextWord(line), "Add", "Command word");
+    AssertEqual(NextWord(line), "2017-01-01", "Date word");
+    AssertEqual(ParseEvent(line), "sport event ", "Event from a view");
+    AssertEqual(ParseEvent(string_view("   ")), "", "Only spaces");
+    string_view empty = "   ";
+    AssertEqual(NextWord(empty), "", "No word");
+  }
+}
+void TestLineReader() {
+  const string text = "first\n\nthird line that is longer than a block\nlast";
+  FILE *file = tmpfile();
+  fwrite(text.data(), 1, text.size(), file);
+  rewind(file);
+  LineReader reader(file, 4);
+  vector<string> lines;
+  for (string_view line; reader.Next(line);) {
+    lines.emplace_back(line);
+  }
+  fclose(file);
+  AssertEqual(lines,
+              vector<string>{"first", "", "third line that is longer than a "
+                                          "block",
+                             "last"},
+              "Lines across blocks");
+
+  // Lines from a pipe come out as written; Interrupt ends a waiting Next.
+  int fds[2];
+  Assert(pipe(fds) == 0, "Pipe");
+  FILE *input = fdopen(fds[0], "rb");
+  LineReader piped(input);
+  Assert(write(fds[1], "one\ntwo", 7) == 7, "Write");
+  string_view line;
+  Assert(piped.Next(line) && line == "one", "Line before the writer ends");
+  thread interrupter([&piped] {
+    this_thread::sleep_for(chrono::milliseconds(20));
+    piped.Interrupt();
+  });
+  Assert(!piped.Next(line), "Interrupted mid-line");
+  interrupter.join();
+  Assert(!piped.Next(line), "Stays interrupted");
+  close(fds[1]);
+  fclose(input);
 }
+void TestSpscQueue() {
+  SpscQueue<int> queue(3);
+  atomic<bool> stop{false};
+  int value = 0;
+  Assert(!queue.TryPop(value), "Empty");
+  for (int i = 0; i < 4; ++i) {
+    value = i;
+    Assert(queue.TryPush(value), "Room for 4");
+  }
+  Assert(!queue.TryPush(value), "Full");
 
+  // A slow side makes the other one sleep; items still come in order.
+  const int kItems = 5000;
+  thread producer([&] {
+    for (int i = 4; i < kItems; ++i) {
+      int item = i;
+      queue.Push(item, stop);
+      if (i % 1000 == 0) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+      }
+    }
+  });
+  int in_order = 0;
+  for (int i = 0; i < kItems; ++i) {
+    if (i % 1000 == 0) {
+      this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    in_order += queue.Pop(value, stop) && value == i;
+  }
+  producer.join();
+  AssertEqual(in_order, kItems, "Every item in order");
+
+  thread stopper([&] {
+    this_thread::sleep_for(chrono::milliseconds(20));
+    stop = true;
+    queue.Wake();
+  });
+  Assert(!queue.Pop(value, stop), "Stopped while sleeping");
+  stopper.join();
+}
+
+// Output of running `text` line by line, or through RunPipeline, and the
+// message of the exception that stopped it, if any.
+string RunCommands(const string &text, bool pipeline) {
+  FILE *file = tmpfile();
+  fwrite(text.data(), 1, text.size(), file);
+  rewind(file);
+  LineReader reader(file, 16);
+  Database db;
+  ostringstream os;
+  try {
+    OutputBuffer out(os);
+    try {
+      if (pipeline) {
+        RunPipeline(reader, db, out);
+      } else {
+        for (string_view line; reader.Next(line);) {
+          ExecuteCommand(line, db, out);
+        }
+      }
+    } catch (...) {
+      out.Flush();
+      throw;
+    }
+  } catch (exception &e) {
+    os << "! " << e.what();
+  }
+  fclose(file);
+  return os.str();
+}
+void TestPipeline() {
+  string text;
+  for (int i = 0; i < 3000; ++i) {
+    text += "Add 2017-01-" + to_string(1 + i % 28) + " event " +
+            to_string(i % 37) + "\n";
+    if (i % 100 == 0) {
+      text += R"(Find event > "event 2" AND date < 2017-01-10)" "\n";
+      text += "Last 2017-01-" + to_string(1 + i % 28) + "\n\n";
+    }
+    if (i % 700 == 0) {
+      text += "Print\n";
+      text += R"(Del event == "event )" + to_string(i % 37) + "\"\n";
+    }
+  }
+  const string expected = RunCommands(text, false);
+  AssertEqual(RunCommands(text, true), expected, "Same output");
+  Assert(expected.find("Removed") != string::npos, "Commands ran");
+
+  for (const string failure : {"Add 2017-13-40 event", "Find date >",
+                               "Unknown command", "Load missing.bin"}) {
+    const string failing = text + failure + "\nPrint\n" + text;
+    const string output = RunCommands(failing, true);
+    AssertEqual(output, RunCommands(failing, false), failure);
+    Assert(output.find("! ") != string::npos, failure + " stops");
+  }
+
+  // Large results reach the output stage in bounded batches.
+  {
+    Database db;
+    for (int i = 0; i < 1000; ++i) {
+      db.Add({2017, 1, 1 + i % 28}, "event " + to_string(i));
+    }
+    for (const char *line : {"Print", "Find date > 2017-01-01"}) {
+      ParsedCommand command = ParseCommand(line);
+      size_t batches = 0, entries = 0, largest = 0;
+      RunCommand(command, db, [&](CommandOutput &output) {
+        ++batches;
+        entries += output.entries.size();
+        largest = max(largest, output.entries.size());
+      });
+      AssertEqual(largest, kBatchEntries, string(line) + " batch size");
+      AssertEqual(batches, (entries + kBatchEntries) / kBatchEntries,
+                  string(line) + " batches");
+    }
+  }
+
+  // A failure stops reading input that is still open.
+  int fds[2];
+  Assert(pipe(fds) == 0, "Pipe");
+  const string failing = "Add 2017-01-01 a\nUnknown command\nPrint\n";
+  Assert(write(fds[1], failing.data(), failing.size()) ==
+             static_cast<ssize_t>(failing.size()),
+         "Write");
+  FILE *input = fdopen(fds[0], "rb");
+  LineReader reader(input);
+  Database db;
+  ostringstream os;
+  try {
+    OutputBuffer out(os);
+    RunPipeline(reader, db, out);
+    Assert(false, "Failure rethrown");
+  } catch (logic_error &) {
+  }
+  close(fds[1]);
+  fclose(input);
+}
+void TestOutputBuffer() {
+  ostringstream os;
+  {
+    OutputBuffer out(os, 8);
+    out << Date{2017, 1, 7} << ' ' << "xmas" << '\n';
+    out << "Found " << 2 << " entries" << '\n';
+    out << string(20, 'x');
+    out.Flush();
+    AssertEqual(os.str(),
+                "2017-01-07 xmas\nFound 2 entries\n" + string(20, 'x'),
+                "Output through a small buffer");
+    out << -15;
+  }
+  AssertEqual(os.str().substr(os.str().size() - 3), "-15",
+              "Destructor flushes");
+}
 void TestParseCondition() {
   {
     istringstream is("date != 2017-11-18");
@@ -164,6 +762,330 @@ void TestParseCondition() {
     Assert(root->Evaluate({2016, 1, 2}, "event"), "Parse condition 30");
   }
 }
+void TestTokenizer() {
+  {
+    const string text = R"(date >= 2017-1-01 AND (event != "a b"))";
+    vector<string> values;
+    vector<TokenType> types;
+    for (TokenIterator it(text), end; it != end; ++it) {
+      values.emplace_back(it->value);
+      types.push_back(it->type);
+    }
+    AssertEqual(values,
+                vector<string>{"date", ">=", "2017-1-01", "AND", "(", "event",
+                               "!=", "a b", ")"},
+                "Token values");
+    Assert(types == vector<TokenType>{TokenType::COLUMN, TokenType::COMPARE_OP,
+                                      TokenType::DATE, TokenType::LOGICAL_OP,
+                                      TokenType::PAREN_LEFT, TokenType::COLUMN,
+                                      TokenType::COMPARE_OP, TokenType::EVENT,
+                                      TokenType::PAREN_RIGHT},
+           "Token types");
+  }
+  {
+    const string_view text = R"(event == "x")";
+    TokenIterator it(text);
+    ++it;
+    ++it;
+    Assert(it->value.data() == text.data() + 10, "Event token views the text");
+    Assert(TokenIterator("   ") == TokenIterator(), "Blank text has no tokens");
+  }
+  {
+    auto root =
+        ParseCondition(string_view(R"(date < 2017-01-01 OR event == "x")"));
+    Assert(root->Evaluate({2016, 1, 1}, "y"), "Parse from a view 1");
+    Assert(root->Evaluate({2018, 1, 1}, "x"), "Parse from a view 2");
+    Assert(!root->Evaluate({2018, 1, 1}, "y"), "Parse from a view 3");
+  }
+  try {
+    ParseCondition(string_view("dote == 2017-01-01"));
+    Assert(false, "Misspelled column must throw");
+  } catch (logic_error &) {
+  }
+}
+void TestDateOrdering() {
+  {
+    Date date{2017, 11, 18};
+    AssertEqual(date.GetYear(), 2017, "Packed year");
+    AssertEqual(date.GetMonth(), 11, "Packed month");
+    AssertEqual(date.GetDay(), 18, "Packed day");
+    AssertEqual(date.getDate(), "2017-11-18", "Packed date format");
+  }
+  {
+    Assert(Date{2017, 1, 31} < Date{2017, 2, 1}, "Day below next month");
+    Assert(Date{2016, 12, 31} < Date{2017, 1, 1}, "Month below next year");
+    Assert(Date{0, 1, 1} < Date{1, 1, 1}, "Zero year");
+    Assert(Date{-1, 12, 31} < Date{0, 1, 1}, "Negative year");
+    AssertEqual(Date{-1, 12, 31}.GetYear(), -1, "Negative year unpacked");
+    Assert(Date{2017, 1, 1} == Date{2017, 1, 1}, "Equal dates");
+    Assert(Date{2017, 1, 1} != Date{2017, 1, 2}, "Different dates");
+    Assert(Date{2017, 1, 2} >= Date{2017, 1, 2}, "Greater or equal");
+  }
+}
+string ParseDateError(const string &text) {
+  try {
+    ParseDate(string_view(text));
+  } catch (exception &e) {
+    return e.what();
+  }
+  return "";
+}
+void TestParseDate() {
+  {
+    AssertEqual(ParseDate("2017-01-07").getDate(), "2017-01-07",
+                "Parse padded date");
+    AssertEqual(ParseDate("1-2-3").getDate(), "0001-02-03",
+                "Parse short date");
+    AssertEqual(ParseDate("+1-+2-+3").getDate(), "0001-02-03",
+                "Parse signed date");
+    AssertEqual(ParseDate("12345-12-31").getDate(), "12345-12-31",
+                "Wide year");
+    AssertEqual(ParseDate("-1-1-1").getDate(), "00-1-01-01",
+                "Negative year keeps setfill layout");
+  }
+  {
+    AssertEqual(ParseDateError("2017-13-01"), "Month value is invalid: 13",
+                "Bad month");
+    AssertEqual(ParseDateError("2017-12-32"), "Day value is invalid: 32",
+                "Bad day");
+    AssertEqual(ParseDateError("2017/12/31"), "Wrong date format: 2017/12/31",
+                "Bad separator");
+    AssertEqual(ParseDateError("2017-12-31x"),
+                "Wrong date format: 2017-12-31x", "Trailing text");
+    AssertEqual(ParseDateError("2017--1-1"), "Month value is invalid: -1",
+                "Negative month");
+    AssertEqual(ParseDateError("2017-01-"), "Day value is invalid: 0",
+                "Empty day");
+  }
+  {
+    char buffer[kMaxDateLength];
+    char *end = WriteDate(buffer, Date{987, 6, 5});
+    AssertEqual(string(buffer, end), "0987-06-05", "Write into buffer");
+    ostringstream os;
+    os << Date{2017, 11, 18};
+    AssertEqual(os.str(), "2017-11-18", "Stream output");
+  }
+}
+void TestEventSet() {
+  {
+    EventSet events;
+    Assert(events.Add(1), "Add new event");
+    Assert(!events.Add(1), "Add duplicate event");
+    AssertEqual(events.Size(), 1u, "Duplicate is stored once");
+  }
+  {
+    EventSet events;
+    for (int round = 0; round < 2; ++round) {
+      for (EventId i = 100; i > 0; --i) {
+        events.Add(i);
+      }
+    }
+    AssertEqual(events.Size(), 100u, "Dedup beyond the linear scan");
+    AssertEqual(events.GetAll().back(), 1u, "Insertion order kept");
+    AssertEqual(events.RemoveIf([](EventId event) { return event % 10 != 7; }),
+                90, "Remove most events");
+    AssertEqual(events.GetAll(),
+                vector<EventId>{97, 87, 77, 67, 57, 47, 37, 27, 17, 7},
+                "Order after remove");
+    Assert(events.Contains(47), "Kept event found");
+    Assert(!events.Contains(46), "Removed event not found");
+    Assert(events.Add(46), "Removed event can be added again");
+  }
+}
+void TestEventDictionary() {
+  EventDictionary dictionary;
+  const EventId b = dictionary.Intern("b");
+  const EventId a = dictionary.Intern("a");
+  AssertEqual(dictionary.Intern("b"), b, "Interned twice");
+  AssertEqual(dictionary.Name(a), "a", "Name by id");
+  AssertEqual(dictionary.Find("c"), kNoEvent, "Unknown name");
+  dictionary.SortRanks();
+  AssertEqual(dictionary.Rank(a), 0u, "Rank of a");
+  AssertEqual(dictionary.Rank(b), 1u, "Rank of b");
+  const EventId c = dictionary.Intern("c");
+  const EventId aa = dictionary.Intern("aa");
+  dictionary.SortRanks();
+  AssertEqual(vector<uint32_t>{dictionary.Rank(a), dictionary.Rank(aa),
+                               dictionary.Rank(b), dictionary.Rank(c)},
+              vector<uint32_t>{0, 1, 2, 3}, "Ranks after merge");
+  AssertEqual(dictionary.RankLowerBound("b"), 2u, "Lower bound of b");
+  AssertEqual(dictionary.RankUpperBound("b"), 3u, "Upper bound of b");
+  AssertEqual(dictionary.RankLowerBound("ab"), 2u, "Lower bound of ab");
+  AssertEqual(dictionary.RankUpperBound("ab"), 2u, "Upper bound of ab");
+
+  // A table taken earlier knows only the names sorted into it.
+  const auto table = dictionary.GetRanks();
+  dictionary.Intern("ab");
+  AssertEqual(dictionary.Find(*table, "b"), b, "Found in the table");
+  AssertEqual(dictionary.Find(*table, "ab"), kNoEvent, "Not in the table");
+  AssertEqual(dictionary.RankUpperBound(*table, "ab"), 2u,
+              "Table upper bound of ab");
+}
+void TestInternedEvaluate() {
+  Database db;
+  const vector<string> events = {"a", "b", "ab", "holiday", "", "zz"};
+  for (const auto &event : events) {
+    db.Add({2017, 1, 1}, event);
+  }
+  for (const string condition :
+       {R"(event < "b")", R"(event <= "b")", R"(event > "ab")",
+        R"(event >= "ab")", R"(event == "holiday")", R"(event != "a")",
+        R"(event > "unknown")", R"(event == "unknown")", R"(event <= "")"}) {
+    istringstream is(condition);
+    const auto query = ParseQuery(is);
+    auto root = query.condition;
+    AssertEqual(db.FindIf(query), db.FindIf([root](const Date &date,
+                                                   const string &event) {
+      return root->Evaluate(date, event);
+    }),
+                condition);
+  }
+}
+void TestDbDelete() {
+  Database db;
+  db.Add({2017, 1, 1}, "new year");
+  db.Add({2017, 1, 1}, "holiday");
+  db.Add({2017, 1, 7}, "xmas");
+  Assert(db.DeleteEvent({2017, 1, 1}, "holiday"), "Delete event");
+  Assert(!db.DeleteEvent({2017, 1, 1}, "holiday"), "Delete event twice");
+  AssertEqual(db.DeleteDate({2017, 1, 7}), 1, "Delete date");
+  AssertEqual(db.DeleteDate({2017, 1, 7}), 0, "Delete date twice");
+  ostringstream out;
+  db.Print(out);
+  AssertEqual(out.str(), "2017-01-01 new year\n", "Left after delete");
+}
+DateRange RangeOf(const string &condition) {
+  istringstream is(condition);
+  return ParseQuery(is).dates;
+}
+void TestExtractDateRange() {
+  {
+    auto range = RangeOf("date >= 2017-01-01 AND date < 2017-02-01");
+    AssertEqual(range.first, Date(2017, 1, 1), "Lower bound");
+    Assert(range.Contains({2017, 1, 31}), "Last day inside");
+    Assert(!range.Contains({2017, 2, 1}), "Strict upper bound");
+  }
+  {
+    auto range = RangeOf(R"(event == "x" AND (date == 2017-05-05))");
+    Assert(range.Contains({2017, 5, 5}), "Equal date inside");
+    Assert(!range.Contains({2017, 5, 4}) && !range.Contains({2017, 5, 6}),
+           "Only the equal date");
+  }
+  {
+    auto range = RangeOf("date > 2017-01-01 AND date < 2016-01-01");
+    Assert(range.Empty(), "Contradiction gives an empty range");
+  }
+  {
+    auto range = RangeOf("date == 2017-01-01 OR date == 2017-03-01");
+    Assert(range.Contains({2017, 2, 1}), "OR covers the hull");
+    Assert(!range.Contains({2016, 12, 31}), "OR lower bound");
+  }
+  {
+    Assert(!RangeOf(R"(date < 2017-01-01 OR event == "x")").Empty() &&
+               RangeOf(R"(date < 2017-01-01 OR event == "x")")
+                   .Contains({9999, 1, 1}),
+           "OR with an event leaves dates open");
+    Assert(RangeOf("date != 2017-01-01").Contains({2017, 1, 1}),
+           "Not equal does not narrow");
+    Assert(RangeOf("").Contains(Date::Max()), "Empty condition");
+  }
+}
+DateVerdict VerdictOf(const string &condition, const Date &date) {
+  ConditionProgram program = ParseQuery(condition).program;
+  program.Bind(GetEventDictionary());
+  return program.EvaluateDate(date);
+}
+void TestEvaluateDate() {
+  GetEventDictionary().Intern("holiday");
+  const Date date{2017, 1, 1};
+  Assert(VerdictOf("date == 2017-01-01", date) == DateVerdict::Accept,
+         "Date accepted");
+  Assert(VerdictOf("date != 2017-01-01", date) == DateVerdict::Reject,
+         "Date rejected");
+  Assert(VerdictOf(R"(event == "holiday")", date) ==
+             DateVerdict::DependsOnEvent,
+         "Event decides");
+  Assert(VerdictOf(R"(date > 2017-01-01 AND event == "holiday")", date) ==
+             DateVerdict::Reject,
+         "AND rejected by date");
+  Assert(VerdictOf(R"(date == 2017-01-01 OR event == "holiday")", date) ==
+             DateVerdict::Accept,
+         "OR accepted by date");
+  Assert(VerdictOf(R"(date == 2017-01-01 AND event == "holiday")", date) ==
+             DateVerdict::DependsOnEvent,
+         "AND still depends on event");
+  Assert(VerdictOf(R"(event == "never interned")", date) ==
+             DateVerdict::Reject,
+         "Unknown event never matches");
+  Assert(VerdictOf(R"(event != "never interned" AND date < 2018-01-01)",
+                   date) == DateVerdict::Accept,
+         "Unknown event always differs");
+  Assert(VerdictOf("", date) == DateVerdict::Accept, "Empty condition");
+  Assert(VerdictOf(R"(event == "holiday" AND date == 2017-01-01)", date) ==
+             DateVerdict::DependsOnEvent,
+         "Accepted right side keeps the event");
+  Assert(VerdictOf(R"((event < "x" OR date < 2016-01-01) AND date == )"
+                   "2017-01-01 OR date == 2016-01-01",
+                   date) == DateVerdict::DependsOnEvent,
+         "Nested operations");
+  Assert(VerdictOf(R"(event != "never interned" AND (date == 2016-01-01 )"
+                   R"(OR event == "never interned"))",
+                   date) == DateVerdict::Reject,
+         "Nested unknown events");
+}
+string RandomCondition(mt19937 &gen, int depth) {
+  const vector<string> ops = {"<", "<=", ">", ">=", "==", "!="};
+  const vector<string> values = {"a", "b", "ab", "holiday", "zz", "none"};
+  const int kind = gen() % (depth < 3 ? 5 : 2);
+  if (kind == 0) {
+    return "date " + ops[gen() % ops.size()] + " 2017-0" +
+           to_string(1 + gen() % 3) + "-01";
+  } else if (kind == 1) {
+    return "event " + ops[gen() % ops.size()] + " \"" +
+           values[gen() % values.size()] + "\"";
+  } else if (kind == 2) {
+    return "(" + RandomCondition(gen, depth + 1) + ")";
+  }
+  return RandomCondition(gen, depth + 1) + (kind == 3 ? " AND " : " OR ") +
+         RandomCondition(gen, depth + 1);
+}
+void TestConditionProgram() {
+  auto &dictionary = GetEventDictionary();
+  const vector<string> events = {"a", "b", "ab", "holiday", "zz", ""};
+  for (const auto &event : events) {
+    dictionary.Intern(event);
+  }
+  mt19937 gen(7);
+  for (int i = 0; i < 300; ++i) {
+    const string text = i == 0 ? "" : RandomCondition(gen, 0);
+    istringstream is(text);
+    auto query = ParseQuery(is);
+    query.program.Bind(dictionary);
+    for (int month = 1; month <= 4; ++month) {
+      const Date date{2017, month, 1};
+      const DateVerdict verdict = query.program.EvaluateDate(date);
+      for (const auto &event : events) {
+        const bool matches = query.condition->Evaluate(date, event);
+        AssertEqual(query.program.Evaluate(date, dictionary.Find(event)),
+                    matches, text);
+        Assert(verdict == DateVerdict::DependsOnEvent ||
+                   matches == (verdict == DateVerdict::Accept),
+               "Date verdict " + text);
+      }
+    }
+  }
+  {
+    istringstream is(R"(date > 2017-01-01 AND event == "a" OR date == 2016-01-01)");
+    const auto code = ParseQuery(is).program.GetCode();
+    AssertEqual(code.size(), 5u, "Comparisons plus one jump per operation");
+    Assert(code[1].op == ConditionProgram::OpCode::JumpIfFalse &&
+               code[1].operand == 3,
+           "AND skips its right operand");
+    Assert(code[3].op == ConditionProgram::OpCode::JumpIfTrue &&
+               code[3].operand == 5,
+           "OR skips its right operand");
+  }
+}
 void TestEmptyNode() {
   {
     EmptyNode en;
@@ -214,11 +1136,7 @@ void TestDbAdd() {
 }
 string DoFind(Database &db, const string &str) {
   istringstream is(str);
-  auto condition = ParseCondition(is);
-  auto predicate = [condition](const Date &date, const string &event) {
-    return condition->Evaluate(date, event);
-  };
-  const auto entries = db.FindIf(predicate);
+  const auto entries = db.FindIf(ParseQuery(is));
   ostringstream os;
   for (const auto &entry : entries) {
     os << entry << endl;
@@ -256,11 +1174,875 @@ void TestDbFind() {
 }
 int DoRemove(Database &db, const string &str) {
   istringstream is(str);
-  auto condition = ParseCondition(is);
-  auto predicate = [condition](const Date &date, const string &event) {
-    return condition->Evaluate(date, event);
+  return db.RemoveIf(ParseQuery(is));
+}
+void TestDbFindRange() {
+  Database db;
+  for (int year = 1990; year < 2020; ++year) {
+    for (int month = 1; month <= 12; ++month) {
+      db.Add({year, month, 1}, "first");
+      db.Add({year, month, 15}, "middle");
+    }
+  }
+  AssertEqual(DoFind(db, "date >= 2017-01-01 AND date < 2017-02-01"),
+              "2017-01-01 first\n2017-01-15 middle\n2", "Range find");
+  AssertEqual(DoRemove(db, "date > 2019-12-01"), 1, "Range remove");
+  ostringstream os;
+  os << db.Last({2030, 1, 1});
+  AssertEqual(os.str(), "2019-12-01 first", "Last after range remove");
+}
+void TestDbEventIndex() {
+  for (bool enabled : {false, true}) {
+    Database db;
+    db.EnableEventIndex(enabled);
+    db.Add({2017, 1, 1}, "holiday");
+    db.Add({2017, 1, 1}, "party");
+    db.Add({2017, 3, 8}, "holiday");
+    db.Add({2018, 1, 1}, "holiday");
+    db.Add({2018, 1, 1}, "holiday");
+    db.Add({2016, 1, 1}, "work");
+    const string hint = enabled ? " (indexed)" : "";
+    AssertEqual(DoFind(db, R"(event == "holiday")"),
+                "2017-01-01 holiday\n2017-03-08 holiday\n2018-01-01 "
+                "holiday\n3",
+                "Find by event" + hint);
+    AssertEqual(DoFind(db, R"(date > 2017-01-01 AND event == "holiday")"),
+                "2017-03-08 holiday\n2018-01-01 holiday\n2",
+                "Find by event and range" + hint);
+    AssertEqual(DoFind(db, R"(event == "holiday" AND event == "party")"), "0",
+                "Contradicting events" + hint);
+    AssertEqual(DoRemove(db, R"(event == "holiday" AND date != 2017-03-08)"),
+                2, "Remove by event" + hint);
+    AssertEqual(db.DeleteDate({2017, 3, 8}), 1, "Delete date" + hint);
+    AssertEqual(DoFind(db, R"(event == "holiday")"), "0",
+                "Index follows removals" + hint);
+    db.Add({2015, 1, 1}, "holiday");
+    Assert(db.DeleteEvent({2017, 1, 1}, "party"), "Delete event" + hint);
+    AssertEqual(DoFind(db, R"(event == "party" OR event == "holiday")"),
+                "2015-01-01 holiday\n1", "Index follows adds" + hint);
+    ostringstream out;
+    db.Print(out);
+    AssertEqual(out.str(), "2015-01-01 holiday\n2016-01-01 work\n",
+                "Left after removals" + hint);
+    AssertEqual(db.GetIndexedEventCount(), enabled ? 2u : 0u,
+                "Emptied events leave the index" + hint);
+  }
+  {
+    Database db;
+    db.EnableEventIndex(true);
+    for (int i = 0; i < 100; ++i) {
+      db.Add({2017, 1, 1 + i % 28}, "churn " + to_string(i));
+      AssertEqual(DoRemove(db, "date == 2017-01-" +
+                                   string(i % 28 < 9 ? "0" : "") +
+                                   to_string(1 + i % 28)),
+                  1, "Churn removal");
+    }
+    db.Add({2017, 1, 1}, "kept");
+    Assert(!db.DeleteEvent({2017, 1, 2}, "kept"), "Missing event");
+    AssertEqual(db.GetIndexedEventCount(), 1u, "Index doesn't grow");
+  }
+}
+void TestDbForEachIf() {
+  for (bool indexed : {false, true}) {
+    Database db;
+    db.EnableEventIndex(indexed);
+    db.Add({2017, 1, 1}, "new year");
+    db.Add({2017, 1, 1}, "holiday");
+    db.Add({2017, 1, 7}, "xmas");
+    db.Add({2017, 1, 7}, "holiday");
+    for (const string condition :
+         {"", R"(event == "holiday")", "date > 2017-01-01",
+          R"(event != "holiday" AND date < 2017-01-07)"}) {
+      istringstream is(condition);
+      const auto query = ParseQuery(is);
+      vector<string> streamed;
+      const int count =
+          db.ForEachIf(query, [&streamed](const Date &date, string_view event) {
+            streamed.push_back(date.getDate() + " " + string(event));
+          });
+      AssertEqual(streamed, db.FindIf(query), "Stream " + condition);
+      AssertEqual(count, static_cast<int>(streamed.size()),
+                  "Count " + condition);
+    }
+  }
+}
+template <typename DB> string PrintOf(const DB &db) {
+  ostringstream os;
+  db.Print(os);
+  return os.str();
+}
+void TestSnapshot() {
+  const string path = "test_snapshot.bin";
+  SyncDirectory(path);
+  SyncDirectory("./" + path);
+  try {
+    SyncDirectory("missing_directory/" + path);
+    Assert(false, "Missing directory");
+  } catch (runtime_error &) {
+  }
+  Database db;
+  db.Add({2017, 1, 7}, "xmas");
+  db.Add({2017, 1, 1}, "new year");
+  db.Add({2017, 1, 1}, "holiday");
+  db.Add({-5, 12, 31}, "ancient");
+  for (int i = 20; i > 0; --i) {
+    db.Add({2018, 2, 2}, "event " + to_string(i));
+  }
+  db.Add({2019, 3, 3}, "deleted");
+  db.DeleteDate({2019, 3, 3});
+  db.Save(path);
+  {
+    Database loaded;
+    loaded.Add({2000, 1, 1}, "replaced");
+    loaded.Load(path);
+    AssertEqual(PrintOf(loaded), PrintOf(db), "Same entries after load");
+    AssertEqual(loaded.Last({2017, 1, 6}), "2017-01-01 holiday",
+                "Insertion order kept");
+    loaded.Add({2018, 2, 2}, "event 7");
+    loaded.Add({2018, 2, 2}, "event 21");
+    AssertEqual(DoRemove(loaded, R"(event >= "event 2" AND event < "f")"),
+                10, "Buckets indexed after load");
+  }
+  {
+    Database loaded;
+    loaded.EnableEventIndex(true);
+    loaded.Load(path);
+    AssertEqual(DoFind(loaded, R"(event == "xmas")"), "2017-01-07 xmas\n1",
+                "Event index rebuilt after load");
+  }
+  {
+    Database empty;
+    empty.Save(path);
+    db.Load(path);
+    AssertEqual(PrintOf(db), "", "Empty snapshot");
+  }
+  db.Add({2017, 1, 1}, "new year");
+  db.Save(path);
+  vector<char> data = ReadFile(path);
+  for (size_t position : {size_t{0}, size_t{8}, data.size() / 2,
+                          data.size() - 1}) {
+    data[position] ^= 1;
+    ofstream(path, ios::binary).write(data.data(), data.size());
+    data[position] ^= 1;
+    try {
+      Database().Load(path);
+      Assert(false, "Corruption at " + to_string(position) + " detected");
+    } catch (runtime_error &) {
+    }
+  }
+  remove(path.c_str());
+}
+void TestSnapshotChunks() {
+  const string path = "test_chunks.bin";
+  SnapshotColumns columns;
+  columns.names = {"a", "b", "c"};
+  columns.offsets = {0};
+  for (int day = 1; day <= 9; ++day) {
+    columns.dates.push_back(Date(2017, 1, day).GetKey());
+    for (int id = 0; id < day % 3 + 1; ++id) {
+      columns.events.push_back(id);
+    }
+    columns.offsets.push_back(columns.events.size());
+  }
+  size_t plain_size = 0;
+  for (auto encoding :
+       {SnapshotEncoding::Plain, SnapshotEncoding::Compressed}) {
+    const string hint =
+        encoding == SnapshotEncoding::Plain ? " (plain)" : " (compressed)";
+    WriteSnapshot(path, columns, encoding, 4);
+    vector<char> data = ReadFile(path);
+    const SnapshotView view = ParseSnapshot(data.data(), data.size());
+    AssertEqual(view.chunk_count, 4u, "Chunks of at least 4 events" + hint);
+    if (encoding == SnapshotEncoding::Plain) {
+      plain_size = data.size();
+    } else {
+      Assert(data.size() < plain_size, "Compressed is smaller");
+    }
+    Database db, opened;
+    db.Load(path);
+    AssertEqual(db.Last({2017, 1, 5}), "2017-01-05 c",
+                "Last of a chunk" + hint);
+    AssertEqual(db.Last({2017, 1, 9}), "2017-01-09 a", "Last chunk" + hint);
+    AssertEqual(DoFind(db, R"(event == "c")"),
+                "2017-01-02 c\n2017-01-05 c\n2017-01-08 c\n3",
+                "All chunks" + hint);
+    opened.Open(path);
+    AssertEqual(PrintOf(opened), PrintOf(db), "Open" + hint);
+
+    // A damaged event in the last chunk, which the header check can't see.
+    const char *last_event =
+        encoding == SnapshotEncoding::Plain
+            ? reinterpret_cast<const char *>(view.events + view.event_count -
+                                             1)
+            : reinterpret_cast<const char *>(view.data + view.data_size - 1);
+    data[last_event - data.data()] ^= 8;
+    ofstream(path, ios::binary).write(data.data(), data.size());
+    try {
+      db.Load(path);
+      Assert(false, "Corrupt chunk detected" + hint);
+    } catch (runtime_error &) {
+    }
+    AssertEqual(db.Last({2017, 1, 9}), "2017-01-09 a",
+                "Kept after failure" + hint);
+    if (encoding == SnapshotEncoding::Plain) {
+      // Open checks a chunk once one of its dates is read, so the first
+      // chunks still answer.
+      Database damaged;
+      damaged.Open(path);
+      AssertEqual(damaged.Last({2017, 1, 2}), "2017-01-02 c",
+                  "Intact chunk served");
+      for (int attempt = 0; attempt < 2; ++attempt) {
+        try {
+          damaged.Last({2017, 1, 9});
+          Assert(false, "Corrupt chunk detected on read");
+        } catch (runtime_error &) {
+        }
+      }
+      // Commands answer with the error and the session goes on.
+      const string commands = "Open " + path + "\nLast 2017-01-09\n" +
+                              R"(Find event == "c")" + "\nPrint\n" +
+                              "Last 2017-01-02\n";
+      const string output = RunCommands(commands, false);
+      AssertEqual(RunCommands(commands, true), output, "Pipeline alike");
+      size_t reported = 0;
+      for (size_t at = 0;
+           (at = output.find("Corrupt snapshot", at)) != string::npos; ++at) {
+        ++reported;
+      }
+      AssertEqual(reported, 3u, "Last, Find and Print report it");
+      Assert(output.find("2017-01-05 c\n2017-01-08 c\nCorrupt") !=
+                 string::npos,
+             "Entries before the damaged chunk");
+      AssertEqual(output.substr(output.size() - 13), "2017-01-02 c\n",
+                  "Later commands run");
+      Database indexed;
+      indexed.EnableEventIndex(true);
+      try {
+        indexed.Open(path);
+        Assert(false, "Corrupt chunk detected by the index");
+      } catch (runtime_error &) {
+      }
+    }
+    // A damaged name fails Open at once.
+    data[view.names - data.data()] ^= 8;
+    data[last_event - data.data()] ^= 8;
+    ofstream(path, ios::binary).write(data.data(), data.size());
+    try {
+      Database damaged;
+      damaged.Open(path);
+      Assert(false, "Corrupt name detected" + hint);
+    } catch (runtime_error &) {
+    }
+  }
+  remove(path.c_str());
+}
+void TestShardedDatabase() {
+  const vector<string> conditions = {
+      "",
+      R"(event == "e3")",
+      "date >= 2017-06-01 AND date < 2018-03-01",
+      R"(date > 2019-01-01 OR event < "e2")",
+      R"(date == 2018-02-02 AND event != "e1")",
+  };
+  mt19937 random(42);
+  auto random_date = [&random] {
+    return Date(2016 + random() % 5, 1 + random() % 12, 1 + random() % 28);
+  };
+  Database reference;
+  ShardedDatabase sharded(4, {{2017, 1, 1}, {2019, 12, 31}});
+  for (int i = 0; i < 3000; ++i) {
+    const Date date = random_date();
+    const string event = "e" + to_string(random() % 20);
+    switch (random() % 10) {
+    case 0:
+      AssertEqual(sharded.DeleteDate(date), reference.DeleteDate(date),
+                  "DeleteDate");
+      break;
+    case 1:
+      AssertEqual(sharded.DeleteEvent(date, event),
+                  reference.DeleteEvent(date, event), "DeleteEvent");
+      break;
+    case 2: {
+      const string &condition = conditions[random() % conditions.size()];
+      AssertEqual(sharded.RemoveIf(ParseQuery(condition)),
+                  reference.RemoveIf(ParseQuery(condition)),
+                  "RemoveIf " + condition);
+      break;
+    }
+    default:
+      sharded.Add(date, event);
+      reference.Add(date, event);
+    }
+  }
+  for (const string &condition : conditions) {
+    AssertEqual(sharded.FindIf(ParseQuery(condition)),
+                reference.FindIf(ParseQuery(condition)),
+                "FindIf " + condition);
+  }
+  for (int i = 0; i < 100; ++i) {
+    const Date date = random_date();
+    string expected = "No entries";
+    try {
+      expected = reference.Last(date);
+    } catch (invalid_argument &) {
+    }
+    try {
+      AssertEqual(sharded.Last(date), expected, "Last");
+    } catch (invalid_argument &) {
+      AssertEqual(string("No entries"), expected, "No Last");
+    }
+  }
+  ostringstream sharded_out, reference_out;
+  sharded.Print(sharded_out);
+  reference.Print(reference_out);
+  AssertEqual(sharded_out.str(), reference_out.str(), "Print");
+
+  // Writers in every shard, some with names never seen before, while
+  // readers query across all of them.
+  ShardedDatabase shared(4, {{2000, 1, 1}, {2003, 12, 31}});
+  vector<thread> threads;
+  for (int writer = 0; writer < 4; ++writer) {
+    threads.emplace_back([&shared, writer] {
+      for (int i = 0; i < 500; ++i) {
+        shared.Add({2000 + writer, 1 + i % 12, 1 + i / 12 % 28},
+                   "w" + to_string(writer) + " " + to_string(i % 50));
+      }
+    });
+  }
+  // Readers share one query; binding must not write to it.
+  const Query range = ParseQuery(R"(event >= "w1" AND event < "w3")");
+  atomic<int> readers_done{0};
+  for (int reader = 0; reader < 4; ++reader) {
+    threads.emplace_back([&shared, &range, &readers_done] {
+      for (int i = 0; i < 50; ++i) {
+        shared.FindIf(range);
+        try {
+          shared.Last({2003, 12, 31});
+        } catch (invalid_argument &) {
+        }
+      }
+      ++readers_done;
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  AssertEqual(readers_done.load(), 4, "Readers done");
+  AssertEqual(shared.FindIf(ParseQuery("")).size(), 2000u, "Every Add kept");
+  AssertEqual(shared.FindIf(range).size(), 1000u,
+              "Ranks sorted after new names");
+}
+void TestVersionedDatabase() {
+  const vector<string> conditions = {
+      "",
+      R"(event == "e3")",
+      "date >= 2017-06-01 AND date < 2018-03-01",
+      R"(date > 2019-01-01 OR event < "e2")",
+      R"(date == 2018-02-02 AND event != "e1")",
+  };
+  mt19937 random(7);
+  auto random_date = [&random] {
+    return Date(2016 + random() % 5, 1 + random() % 12, 1 + random() % 28);
+  };
+  Database reference;
+  VersionedDatabase versioned;
+  versioned.Add({-1, 12, 31}, "e0");
+  reference.Add({-1, 12, 31}, "e0");
+  for (int i = 0; i < 3000; ++i) {
+    const Date date = random_date();
+    const string event = "e" + to_string(random() % 20);
+    switch (random() % 10) {
+    case 0:
+      AssertEqual(versioned.DeleteDate(date), reference.DeleteDate(date),
+                  "DeleteDate");
+      break;
+    case 1:
+      AssertEqual(versioned.DeleteEvent(date, event),
+                  reference.DeleteEvent(date, event), "DeleteEvent");
+      break;
+    case 2: {
+      const string &condition = conditions[random() % conditions.size()];
+      AssertEqual(versioned.RemoveIf(ParseQuery(condition)),
+                  reference.RemoveIf(ParseQuery(condition)),
+                  "RemoveIf " + condition);
+      break;
+    }
+    default:
+      versioned.Add(date, event);
+      reference.Add(date, event);
+    }
+  }
+  for (const string &condition : conditions) {
+    AssertEqual(versioned.FindIf(ParseQuery(condition)),
+                reference.FindIf(ParseQuery(condition)),
+                "FindIf " + condition);
+  }
+  auto last_of = [](const auto &db, const Date &date) -> string {
+    try {
+      return db.Last(date);
+    } catch (invalid_argument &) {
+      return "No entries";
+    }
   };
-  return db.RemoveIf(predicate);
+  for (int i = 0; i < 100; ++i) {
+    const Date date = random_date();
+    AssertEqual(last_of(versioned, date), last_of(reference, date), "Last");
+  }
+  AssertEqual(last_of(versioned, {-2, 1, 1}), "No entries", "Before all");
+  AssertEqual(PrintOf(versioned), PrintOf(reference), "Print");
+
+  // A snapshot keeps its version, and what later writes replace stays
+  // around only while it is held.
+  for (Date date : {Date(-1, 12, 31), Date(2021, 1, 1)}) {
+    versioned.Add(date, "e0");
+    reference.Add(date, "e0");
+  }
+  {
+    const auto snapshot = versioned.GetSnapshot();
+    const string before = PrintOf(reference);
+    versioned.DeleteDate({-1, 12, 31});
+    versioned.RemoveIf(ParseQuery(""));
+    versioned.Add({2020, 1, 1}, "after");
+    ostringstream out;
+    snapshot.Print(out);
+    AssertEqual(out.str(), before, "Snapshot unchanged");
+    AssertEqual(versioned.FindIf(ParseQuery("")),
+                vector<string>{"2020-01-01 after"}, "New version");
+    Assert(versioned.GetRetiredCount() == 3, "Retired while pinned");
+  }
+  versioned.Add({2020, 1, 1}, "later");
+  AssertEqual(versioned.GetRetiredCount(), 0u, "Reclaimed once unpinned");
+
+  // More snapshots held by one thread than one block has slots.
+  {
+    const size_t before = versioned.FindIf(ParseQuery("")).size();
+    vector<VersionedDatabase::Snapshot> held;
+    for (int i = 0; i < 3 * int(EpochManager::kSlots); ++i) {
+      held.push_back(versioned.GetSnapshot());
+      versioned.Add({2021, 1, 1}, "held " + to_string(i));
+    }
+    for (size_t i = 0; i < held.size(); i += EpochManager::kSlots - 1) {
+      AssertEqual(held[i].FindIf(ParseQuery("")).size(), before + i,
+                  "Held snapshot " + to_string(i));
+    }
+    Assert(versioned.GetRetiredCount() > 0, "Retired while held");
+  }
+  versioned.Add({2021, 1, 2}, "released");
+  AssertEqual(versioned.GetRetiredCount(), 0u, "Reclaimed once released");
+
+  // Readers see every write before some point and none after it.
+  VersionedDatabase shared;
+  const int kWrites = 2000;
+  atomic<bool> done{false};
+  vector<thread> readers;
+  atomic<int> torn{0};
+  // Matches everything, through ranks and a name never interned; the
+  // readers share it.
+  const Query everything = ParseQuery(R"(event >= "e" AND event != "none")");
+  for (int reader = 0; reader < 3; ++reader) {
+    readers.emplace_back([&] {
+      while (!done) {
+        const auto snapshot = shared.GetSnapshot();
+        const auto entries = snapshot.FindIf(everything);
+        for (size_t i = 0; i < entries.size(); ++i) {
+          if (entries[i] != Date(2000 + i / 336, 1 + i / 28 % 12, 1 + i % 28)
+                                    .getDate() +
+                                " e" + to_string(i)) {
+            ++torn;
+          }
+        }
+      }
+    });
+  }
+  for (int i = 0; i < kWrites; ++i) {
+    shared.Add({2000 + i / 336, 1 + i / 28 % 12, 1 + i % 28},
+               "e" + to_string(i));
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  AssertEqual(torn.load(), 0, "Consistent snapshots");
+  AssertEqual(shared.FindIf(ParseQuery("")).size(), size_t(kWrites),
+              "Every write kept");
+}
+void TestThreadPool() {
+  ThreadPool pool(3);
+  AssertEqual(pool.GetConcurrency(), 4u, "Caller counted");
+  for (size_t count : {0, 1, 5, 1000}) {
+    vector<int> calls(count);
+    pool.ParallelFor(count, [&calls](size_t i) { ++calls[i]; });
+    AssertEqual(count_if(calls.begin(), calls.end(),
+                         [](int called) { return called == 1; }),
+                static_cast<long>(count), "Every index once");
+  }
+  atomic<int> finished{0};
+  try {
+    pool.ParallelFor(100, [&finished](size_t i) {
+      if (i % 10 == 3) {
+        throw runtime_error("body");
+      }
+      ++finished;
+    });
+    Assert(false, "Exception rethrown");
+  } catch (runtime_error &e) {
+    AssertEqual(string(e.what()), "body", "First exception");
+  }
+  AssertEqual(finished.load(), 90, "Others still run");
+
+  // Index 0 waits for all the others, which the workers can only reach by
+  // stealing the rest of the caller's slice.
+  atomic<int> done{0};
+  pool.ParallelFor(100, [&done](size_t i) {
+    if (i == 0) {
+      while (done.load() < 99) {
+        this_thread::yield();
+      }
+    } else {
+      ++done;
+    }
+  });
+  AssertEqual(done.load(), 99, "Slices stolen");
+}
+void TestParallelFindIf() {
+  const string path = "test_parallel.bin";
+  // Queries run sequentially on a pool of one thread.
+  ThreadPool pool(3);
+  Database db;
+  db.SetThreadPool(&pool);
+  // Dense dates next to sparse ones, so that partitions differ in width.
+  for (int day = 1; day <= 28; ++day) {
+    for (int i = 0; i < 3000; ++i) {
+      db.Add({2000, 1, day}, "e" + to_string(i % 500 + day));
+    }
+  }
+  for (int year = 1800; year < 2100; ++year) {
+    db.Add({year, 6, 1}, "x");
+    db.Add({year, 6, 1}, "y" + to_string(year % 7));
+  }
+  db.Save(path);
+  Database mapped;
+  mapped.SetThreadPool(&pool);
+  mapped.Open(path);
+  mapped.Add({2000, 1, 15}, "late");
+  mapped.DeleteDate({2000, 1, 20});
+  mapped.Add({1950, 2, 2}, "x");
+  remove(path.c_str());
+
+  for (const Database *target : {&db, &mapped}) {
+    for (const string condition :
+         {R"(event != "x" OR date > 1900-01-01)", R"(event > "e3")",
+          "date >= 2000-01-10 AND date < 2000-01-20", R"(event == "x")",
+          "date == 1700-01-01", ""}) {
+      const Query query = ParseQuery(condition);
+      vector<string> expected;
+      target->ForEachIf(query, [&expected](const Date &date, string_view e) {
+        expected.push_back(date.getDate() + " " + string(e));
+      });
+      AssertEqual(target->FindIf(query), expected, condition);
+    }
+  }
+}
+void TestParallelRemoveIf() {
+  const string path = "test_parallel_remove.bin";
+  const auto fill = [](Database &db) {
+    for (int day = 1; day <= 28; ++day) {
+      for (int i = 0; i < 3000; ++i) {
+        db.Add({2000, 1, day}, "e" + to_string(i % 500 + day));
+      }
+    }
+    for (int year = 1800; year < 2100; ++year) {
+      db.Add({year, 6, 1}, "x");
+      db.Add({year, 6, 1}, "y" + to_string(year % 7));
+    }
+  };
+  Database saved;
+  fill(saved);
+  saved.Save(path);
+  ThreadPool pool(3);
+
+  for (bool indexed : {false, true}) {
+    for (bool opened : {false, true}) {
+      const string hint =
+          string(indexed ? " (indexed" : " (") + (opened ? ", opened)" : ")");
+      // The predicate overload filters on this thread only.
+      Database parallel, serial;
+      parallel.SetThreadPool(&pool);
+      for (Database *db : {&parallel, &serial}) {
+        db->EnableEventIndex(indexed);
+        if (opened) {
+          db->Open(path);
+        } else {
+          fill(*db);
+        }
+      }
+      AssertEqual(parallel.RemoveIf(ParseQuery(R"(event > "e3")")),
+                  serial.RemoveIf([](const Date &, const string &event) {
+                    return event > "e3";
+                  }),
+                  "Count" + hint);
+      AssertEqual(
+          parallel.RemoveIf(ParseQuery(
+              R"(date != 2000-01-05 AND (event != "x" OR date < 1900-01-01))")),
+          serial.RemoveIf([](const Date &date, const string &event) {
+            return date != Date{2000, 1, 5} &&
+                   (event != "x" || date < Date{1900, 1, 1});
+          }),
+          "Count of emptied dates" + hint);
+      AssertEqual(PrintOf(parallel), PrintOf(serial), "Print" + hint);
+      for (const string event : {"x", "e10", "e300"}) {
+        const Query query = ParseQuery(R"(event == ")" + event + R"(")");
+        AssertEqual(parallel.FindIf(query), serial.FindIf(query),
+                    "Index of " + event + hint);
+      }
+    }
+  }
+  remove(path.c_str());
+}
+void TestMappedSnapshot() {
+  const string path = "test_mapped.bin";
+  Database db;
+  db.Add({2017, 1, 7}, "xmas");
+  db.Add({2017, 1, 1}, "new year");
+  db.Add({2017, 1, 1}, "holiday");
+  db.Add({2017, 3, 8}, "holiday");
+  db.Add({2018, 1, 1}, "new year");
+  db.Save(path);
+
+  for (bool indexed : {false, true}) {
+    const string hint = indexed ? " (indexed)" : "";
+    Database mapped, reference;
+    mapped.EnableEventIndex(indexed);
+    mapped.Open(path);
+    reference.Load(path);
+    AssertEqual(PrintOf(mapped), PrintOf(reference), "Print" + hint);
+    AssertEqual(mapped.Last({2017, 2, 1}), "2017-01-07 xmas", "Last" + hint);
+
+    // The same changes on both, then the same answers.
+    for (Database *target : {&mapped, &reference}) {
+      target->Add({2017, 1, 1}, "party");
+      target->Add({2017, 1, 1}, "holiday");
+      target->Add({2017, 2, 1}, "groundhog");
+    }
+    AssertEqual(mapped.DeleteDate({2017, 1, 7}), 1, "DeleteDate" + hint);
+    reference.DeleteDate({2017, 1, 7});
+    AssertEqual(mapped.Last({2017, 1, 31}), "2017-01-01 party",
+                "Last after Add" + hint);
+    AssertEqual(mapped.Last({2017, 3, 7}), "2017-02-01 groundhog",
+                "Last from memory" + hint);
+    for (const string condition :
+         {R"(event == "holiday")", "date > 2017-02-01", ""}) {
+      AssertEqual(DoFind(mapped, condition), DoFind(reference, condition),
+                  "Find " + condition + hint);
+    }
+    AssertEqual(DoRemove(mapped, R"(event == "holiday")"), 2, "Del" + hint);
+    DoRemove(reference, R"(event == "holiday")");
+    AssertEqual(PrintOf(mapped), PrintOf(reference), "Print after Del" + hint);
+    AssertEqual(mapped.Last({2017, 12, 31}), "2017-02-01 groundhog",
+                "Last skips removed dates" + hint);
+
+    mapped.Save(path + ".copy");
+    reference.Load(path + ".copy");
+    AssertEqual(PrintOf(reference), PrintOf(mapped), "Save merges" + hint);
+    remove((path + ".copy").c_str());
+  }
+  remove(path.c_str());
+}
+void TestWriteAheadLog() {
+  const string path = "test_wal.log";
+  const string checkpoint = WriteAheadLog::CheckpointPath(path);
+  remove(path.c_str());
+  remove(checkpoint.c_str());
+  string expected;
+  {
+    Database db;
+    WriteAheadLog log(path, db.Recover(path), {2, chrono::hours(1)});
+    db.SetLog(&log);
+    db.Add({2017, 1, 1}, "new year");
+    db.Add({2017, 1, 1}, "new year");
+    db.Add({2017, 1, 1}, "holiday");
+    db.Add({2017, 1, 7}, "xmas");
+    AssertEqual(log.GetSyncCount(), 1u, "Group of two records");
+    db.Add({2017, 3, 8}, "holiday");
+    db.Add({2017, 5, 9}, "victory");
+    AssertEqual(DoRemove(db, R"(event == "holiday" AND date > 2017-01-01)"),
+                1, "Del");
+    AssertEqual(DoRemove(db, R"(event == "nothing")"), 0, "Empty Del");
+    db.DeleteEvent({2017, 1, 1}, "new year");
+    db.DeleteDate({2017, 5, 9});
+    db.Add({2017, 1, 1}, "new year");
+    try {
+      db.RemoveIf([](const Date &, const string &) { return true; });
+      Assert(false, "Predicates can't be logged");
+    } catch (logic_error &) {
+    }
+    expected = PrintOf(db);
+  }
+  {
+    Database db;
+    db.Recover(path);
+    AssertEqual(PrintOf(db), expected, "Replay");
+  }
+  // A torn record at the end is dropped, and so is what follows it.
+  const char torn[] = "\x20\0\0\0garbage";
+  ofstream(path, ios::binary | ios::app).write(torn, sizeof(torn) - 1);
+  {
+    Database db;
+    const uint64_t valid_size = db.Recover(path);
+    AssertEqual(PrintOf(db), expected, "Replay before a torn tail");
+    WriteAheadLog log(path, valid_size, {1, chrono::hours(1)});
+    db.SetLog(&log);
+    db.Add({2018, 1, 1}, "after the tear");
+    expected = PrintOf(db);
+  }
+  {
+    Database db;
+    WriteAheadLog log(path, db.Recover(path));
+    AssertEqual(PrintOf(db), expected, "Append after a torn tail");
+    db.SetLog(&log);
+    db.Checkpoint();
+    db.Add({2019, 1, 1}, "after the checkpoint");
+    // As if the process died between saving a checkpoint and emptying
+    // the log: the records it holds must not be applied twice.
+    db.Save(checkpoint);
+    db.DeleteDate({2017, 1, 1});
+    db.Add({2017, 1, 1}, "holiday");
+    expected = PrintOf(db);
+  }
+  {
+    Database db;
+    db.Recover(path);
+    AssertEqual(PrintOf(db), expected, "Checkpoint and log tail");
+  }
+  remove(path.c_str());
+  remove(checkpoint.c_str());
+}
+void TestCompactor() {
+  const string path = "test_compact.log";
+  const string checkpoint = WriteAheadLog::CheckpointPath(path);
+  string expected;
+  uint64_t log_size = 0;
+  {
+    Database db;
+    WriteAheadLog log(path, db.Recover(path), {16, chrono::hours(1)});
+    Compactor compactor(log, {1000, chrono::hours(1)});
+    db.SetLog(&log);
+    db.SetCompactor(&compactor);
+    for (int i = 0; i < 300; ++i) {
+      db.Add({2017, 1 + i % 12, 1 + i % 28}, "event " + to_string(i % 40));
+      if (i % 7 == 0) {
+        DoRemove(db, "event == \"event " + to_string(i % 40) + "\"");
+      }
+      // Every 50 records outgrow the policy at least once, however long
+      // the syncs of a compaction take.
+      if (i % 50 == 49) {
+        compactor.Wait();
+      }
+    }
+    compactor.Wait();
+    const CompactionMetrics metrics = compactor.GetMetrics();
+    Assert(metrics.compactions > 5, "Compacted in the background");
+    AssertEqual(metrics.error, "", "No compaction error");
+    log_size = compactor.GetLogSize();
+    Assert(!ifstream(WriteAheadLog::RotatedPath(path)).good(),
+           "Rotated log removed");
+    expected = PrintOf(db);
+  }
+  {
+    Database db;
+    const uint64_t valid_size = db.Recover(path);
+    AssertEqual(PrintOf(db), expected, "Checkpoint and log tail");
+    AssertEqual(valid_size, log_size, "Only the tail is replayed");
+  }
+  remove(path.c_str());
+  remove(checkpoint.c_str());
+}
+void TestInterruptedCompactions() {
+  const string path = "test_interrupted.log";
+  const string rotated = WriteAheadLog::RotatedPath(path);
+  const string checkpoint = WriteAheadLog::CheckpointPath(path);
+  for (const string &file : {path, rotated, checkpoint}) {
+    remove(file.c_str());
+  }
+  // Each session logs some records, then starts a compaction by rotating
+  // the log and crashes before the snapshot is written.
+  string expected;
+  for (int session = 0; session < 3; ++session) {
+    Database db;
+    WriteAheadLog log(path, db.Recover(path));
+    AssertEqual(PrintOf(db), expected,
+                "Recovered session " + to_string(session));
+    db.SetLog(&log);
+    for (int i = 0; i < 3; ++i) {
+      db.Add({2017, 1 + session, 1 + i}, "event " + to_string(session));
+    }
+    log.Rotate();
+    db.Add({2018, 1 + session, 1}, "after rotation");
+    expected = PrintOf(db);
+  }
+  {
+    Database db;
+    WriteAheadLog log(path, db.Recover(path));
+    AssertEqual(PrintOf(db), expected, "Every interrupted rotation kept");
+    db.SetLog(&log);
+    db.Checkpoint();
+    Assert(!ifstream(rotated).good(), "Checkpoint drops the rotated log");
+  }
+  {
+    Database db;
+    db.Recover(path);
+    AssertEqual(PrintOf(db), expected, "Recovered from the checkpoint");
+  }
+  remove(path.c_str());
+  remove(checkpoint.c_str());
+}
+void TestBulkLoad() {
+  mt19937 gen(7);
+  vector<pair<Date, string>> entries;
+  for (int i = 0; i < 2000; ++i) {
+    entries.emplace_back(Date(2000 + gen() % 3, 1 + gen() % 12, 1 + gen() % 2),
+                         "event " + to_string(gen() % 30));
+  }
+  entries.emplace_back(Date(-1, 1, 1), "negative year");
+  const size_t half = entries.size() / 2;
+  auto views = [&entries](size_t begin, size_t end) {
+    vector<pair<Date, string_view>> result;
+    for (size_t i = begin; i < end; ++i) {
+      result.emplace_back(entries[i].first, entries[i].second);
+    }
+    return result;
+  };
+  for (bool indexed : {false, true}) {
+    const string hint = indexed ? " (indexed)" : "";
+    Database added, bulk;
+    added.EnableEventIndex(indexed);
+    bulk.EnableEventIndex(indexed);
+    for (const auto &[date, event] : entries) {
+      added.Add(date, event);
+    }
+    bulk.BulkLoad(views(0, half));
+    bulk.BulkLoad(views(half, entries.size()));
+    AssertEqual(PrintOf(bulk), PrintOf(added), "Same as Add" + hint);
+    AssertEqual(DoFind(bulk, R"(event == "event 3")"),
+                DoFind(added, R"(event == "event 3")"), "Find" + hint);
+    AssertEqual(DoRemove(bulk, R"(event == "event 4")"),
+                DoRemove(added, R"(event == "event 4")"), "Del" + hint);
+  }
+  {
+    const string path = "test_bulk.bin";
+    Database added, bulk;
+    for (size_t i = 0; i < half; ++i) {
+      added.Add(entries[i].first, entries[i].second);
+    }
+    added.Save(path);
+    bulk.Open(path);
+    for (size_t i = half; i < entries.size(); ++i) {
+      added.Add(entries[i].first, entries[i].second);
+    }
+    bulk.BulkLoad(views(half, entries.size()));
+    AssertEqual(PrintOf(bulk), PrintOf(added), "Onto a mapped snapshot");
+    remove(path.c_str());
+  }
 }
 void TestDbLast() {
   Database db;
@@ -630,10 +2412,39 @@ Add 2018-03-08 medved\n");
 void TestAll() {
   TestRunner tr;
   tr.RunTest(TestParseEvent, "TestParseEvent");
+  tr.RunTest(TestLineReader, "TestLineReader");
+  tr.RunTest(TestSpscQueue, "TestSpscQueue");
+  tr.RunTest(TestOutputBuffer, "TestOutputBuffer");
   tr.RunTest(TestParseCondition, "TestParseCondition");
+  tr.RunTest(TestTokenizer, "TestTokenizer");
+  tr.RunTest(TestDateOrdering, "TestDateOrdering");
+  tr.RunTest(TestParseDate, "TestParseDate");
+  tr.RunTest(TestEventSet, "TestEventSet");
+  tr.RunTest(TestEventDictionary, "TestEventDictionary");
+  tr.RunTest(TestInternedEvaluate, "TestInternedEvaluate");
+  tr.RunTest(TestDbDelete, "TestDbDelete");
+  tr.RunTest(TestExtractDateRange, "TestExtractDateRange");
+  tr.RunTest(TestDbFindRange, "TestDbFindRange");
+  tr.RunTest(TestEvaluateDate, "TestEvaluateDate");
+  tr.RunTest(TestConditionProgram, "TestConditionProgram");
   tr.RunTest(TestEmptyNode, "Тест 2 из Coursera");
   tr.RunTest(TestDbAdd, "Тест 3(1) из Coursera");
   tr.RunTest(TestDbFind, "Тест 3(2) из Coursera");
+  tr.RunTest(TestDbEventIndex, "TestDbEventIndex");
+  tr.RunTest(TestDbForEachIf, "TestDbForEachIf");
+  tr.RunTest(TestSnapshot, "TestSnapshot");
+  tr.RunTest(TestSnapshotChunks, "TestSnapshotChunks");
+  tr.RunTest(TestMappedSnapshot, "TestMappedSnapshot");
+  tr.RunTest(TestWriteAheadLog, "TestWriteAheadLog");
+  tr.RunTest(TestCompactor, "TestCompactor");
+  tr.RunTest(TestInterruptedCompactions, "TestInterruptedCompactions");
+  tr.RunTest(TestBulkLoad, "TestBulkLoad");
+  tr.RunTest(TestThreadPool, "TestThreadPool");
+  tr.RunTest(TestParallelFindIf, "TestParallelFindIf");
+  tr.RunTest(TestParallelRemoveIf, "TestParallelRemoveIf");
+  tr.RunTest(TestPipeline, "TestPipeline");
+  tr.RunTest(TestShardedDatabase, "TestShardedDatabase");
+  tr.RunTest(TestVersionedDatabase, "TestVersionedDatabase");
   tr.RunTest(TestDbLast, "Тест 3(3) из Coursera");
   tr.RunTest(TestDbRemoveIf, "Тест 3(4) из Coursera");
   tr.RunTest(TestInsertionOrder, "Тест на порядок вывода");
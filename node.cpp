@@ -36,6 +36,7 @@ bool EventComparisonNode::Evaluate(const Date &date,
   } else if (cmp_ == Comparison::NotEqual) {
     return event != value_;
   }
+  return false;
 }
 bool EmptyNode::Evaluate(const Date &date, const std::string &event) const {
   return true;
@@ -10,6 +10,8 @@ enum class Comparison {
   NotEqual
 };
 enum class LogicalOperation { Or, And };
+// A parsed condition. Never changes after parsing, so threads can share it;
+// queries run the ConditionProgram compiled from it.
 class Node {
 public:
   virtual bool Evaluate(const Date &date, const std::string &event) const = 0;
@@ -19,6 +21,8 @@ class DateComparisonNode : public Node {
 public:
   DateComparisonNode(Comparison cmp, const Date &date);
   bool Evaluate(const Date &date, const std::string &event) const override;
+  Comparison GetComparison() const { return cmp_; }
+  const Date &GetDate() const { return date_; }
 
 private:
   const Comparison cmp_;
@@ -29,6 +33,8 @@ class EventComparisonNode : public Node {
 public:
   EventComparisonNode(Comparison cmp, const std::string &value);
   bool Evaluate(const Date &date, const std::string &event) const override;
+  Comparison GetComparison() const { return cmp_; }
+  const std::string &GetValue() const { return value_; }
 
 private:
   const Comparison cmp_;
@@ -46,6 +52,9 @@ public:
   LogicalOperationNode(LogicalOperation op, std::shared_ptr<Node> left,
                        std::shared_ptr<Node> right);
   bool Evaluate(const Date &date, const std::string &event) const override;
+  LogicalOperation GetOperation() const { return op_; }
+  const Node &GetLeft() const { return *left_; }
+  const Node &GetRight() const { return *right_; }
 
 private:
   const LogicalOperation op_;
@@ -0,0 +1,42 @@
+#include "output_buffer.h"
+#include <charconv>
+#include <cstring>
+
+OutputBuffer::OutputBuffer(std::ostream &out, size_t capacity)
+    : out_(out), buffer_(capacity), end_(buffer_.data()) {}
+
+OutputBuffer &OutputBuffer::operator<<(std::string_view text) {
+  if (text.size() > buffer_.size()) {
+    Drain();
+    out_.write(text.data(), text.size());
+    return *this;
+  }
+  Reserve(text.size());
+  std::memcpy(end_, text.data(), text.size());
+  end_ += text.size();
+  return *this;
+}
+
+OutputBuffer &OutputBuffer::operator<<(long long value) {
+  Reserve(24);
+  end_ = std::to_chars(end_, end_ + 24, value).ptr;
+  return *this;
+}
+
+void OutputBuffer::Flush() {
+  Drain();
+  out_.flush();
+}
+
+void OutputBuffer::Grow(size_t size) {
+  Drain();
+  if (buffer_.size() < size) {
+    buffer_.resize(size);
+    end_ = buffer_.data();
+  }
+}
+
+void OutputBuffer::Drain() {
+  out_.write(buffer_.data(), end_ - buffer_.data());
+  end_ = buffer_.data();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "date.h"
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Collects output in a large buffer and hands it to the stream in big
+// chunks: only when the buffer fills up or on an explicit Flush, instead of
+// on every std::endl. Dates and numbers are formatted in place.
+class OutputBuffer {
+public:
+  static constexpr size_t kCapacity = 1 << 16;
+
+  explicit OutputBuffer(std::ostream &out, size_t capacity = kCapacity);
+  ~OutputBuffer() { Flush(); }
+
+  OutputBuffer &operator<<(std::string_view text);
+  OutputBuffer &operator<<(char c) {
+    Reserve(1);
+    *end_++ = c;
+    return *this;
+  }
+  OutputBuffer &operator<<(const Date &date) {
+    Reserve(kMaxDateLength);
+    end_ = WriteDate(end_, date);
+    return *this;
+  }
+  OutputBuffer &operator<<(long long value);
+  OutputBuffer &operator<<(int value) {
+    return *this << static_cast<long long>(value);
+  }
+
+  // Writes the buffered text to the stream and flushes it.
+  void Flush();
+
+private:
+  // Makes room for `size` more chars, draining the buffer if needed.
+  void Reserve(size_t size) {
+    if (static_cast<size_t>(buffer_.data() + buffer_.size() - end_) < size) {
+      Grow(size);
+    }
+  }
+  void Grow(size_t size);
+  void Drain();
+
+  std::ostream &out_;
+  std::vector<char> buffer_;
+  char *end_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include "condition_program.h"
+#include "date.h"
+#include "node.h"
+#include <memory>
+#include <optional>
+#include <string>
+
+// Inclusive range of dates; bounds may fall between real calendar dates.
+struct DateRange {
+  Date first = Date::Min();
+  Date last = Date::Max();
+
+  bool Empty() const { return last < first; }
+  bool Contains(const Date &date) const {
+    return first <= date && date <= last;
+  }
+};
+
+// A parsed condition with what the planner learned about it: every entry
+// the condition accepts lies within `dates` and, if `event` is set, has
+// exactly that event. `program` is the condition compiled for per-event
+// evaluation, `text` the condition as it was parsed.
+struct Query {
+  std::shared_ptr<Node> condition;
+  ConditionProgram program;
+  DateRange dates;
+  std::optional<std::string> event;
+  std::string text;
+};
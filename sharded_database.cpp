@@ -0,0 +1,118 @@
+#include "sharded_database.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+
+ShardedDatabase::ShardedDatabase(size_t shards, const DateRange &range)
+    : shards_(shards) {
+  if (shards == 0 || range.Empty()) {
+    throw invalid_argument("ShardedDatabase needs a shard and a date range");
+  }
+  const int64_t first = range.first.GetKey();
+  const int64_t width =
+      (int64_t{range.last.GetKey()} - first + 1) / static_cast<int64_t>(shards);
+  for (size_t i = 1; i < shards; ++i) {
+    boundaries_.push_back(
+        Date::FromKey(static_cast<int32_t>(first + width * i)));
+  }
+}
+
+void ShardedDatabase::EnableEventIndex(bool enabled) {
+  for (Shard &shard : shards_) {
+    unique_lock<shared_mutex> lock(shard.mutex);
+    shard.db.EnableEventIndex(enabled);
+  }
+}
+
+void ShardedDatabase::Add(const Date &date, string_view event) {
+  Shard &shard = shards_[ShardOf(date)];
+  shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+  if (GetEventDictionary().Find(event) != kNoEvent) {
+    unique_lock<shared_mutex> lock(shard.mutex);
+    shard.db.Add(date, event);
+    return;
+  }
+  // A new name: Add interns it, which no reader may see half done.
+  dictionary_lock.unlock();
+  unique_lock<shared_mutex> exclusive(GetEventDictionaryMutex());
+  unique_lock<shared_mutex> lock(shard.mutex);
+  shard.db.Add(date, event);
+}
+
+bool ShardedDatabase::DeleteEvent(const Date &date, const string &event) {
+  Shard &shard = shards_[ShardOf(date)];
+  shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+  unique_lock<shared_mutex> lock(shard.mutex);
+  return shard.db.DeleteEvent(date, event);
+}
+
+int ShardedDatabase::DeleteDate(const Date &date) {
+  Shard &shard = shards_[ShardOf(date)];
+  shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+  unique_lock<shared_mutex> lock(shard.mutex);
+  return shard.db.DeleteDate(date);
+}
+
+string ShardedDatabase::Last(const Date &date) const {
+  shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+  // Only a shard with nothing up to `date` sends the search further back.
+  for (size_t i = ShardOf(date) + 1; i-- > 0;) {
+    shared_lock<shared_mutex> lock(shards_[i].mutex);
+    try {
+      return shards_[i].db.Last(date);
+    } catch (invalid_argument &) {
+    }
+  }
+  throw invalid_argument("Last not found");
+}
+
+void ShardedDatabase::Print(ostream &out) const {
+  OutputBuffer buffer(out);
+  Print(buffer);
+}
+
+void ShardedDatabase::Print(OutputBuffer &out) const {
+  shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+  const auto locks = LockShards<shared_lock<shared_mutex>>(0, shards_.size());
+  for (const Shard &shard : shards_) {
+    shard.db.Print(out);
+  }
+}
+
+int ShardedDatabase::RemoveIf(const Query &query) {
+  const auto dictionary_lock = LockEventDictionary();
+  const auto [first, last] = ShardsOf(query.dates);
+  const auto locks = LockShards<unique_lock<shared_mutex>>(first, last);
+  int count = 0;
+  for (size_t i = first; i < last; ++i) {
+    count += shards_[i].db.RemoveIf(query);
+  }
+  return count;
+}
+
+vector<string> ShardedDatabase::FindIf(const Query &query) const {
+  const auto dictionary_lock = LockEventDictionary();
+  const auto [first, last] = ShardsOf(query.dates);
+  const auto locks = LockShards<shared_lock<shared_mutex>>(first, last);
+  vector<string> entries;
+  for (size_t i = first; i < last; ++i) {
+    vector<string> found = shards_[i].db.FindIf(query);
+    entries.insert(entries.end(), make_move_iterator(found.begin()),
+                   make_move_iterator(found.end()));
+  }
+  return entries;
+}
+
+size_t ShardedDatabase::ShardOf(const Date &date) const {
+  return upper_bound(boundaries_.begin(), boundaries_.end(), date) -
+         boundaries_.begin();
+}
+
+pair<size_t, size_t> ShardedDatabase::ShardsOf(const DateRange &range) const {
+  if (range.Empty()) {
+    return {0, 0};
+  }
+  return {ShardOf(range.first), ShardOf(range.last) + 1};
+}
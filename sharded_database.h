@@ -0,0 +1,82 @@
+#pragma once
+#include "database.h"
+#include "date.h"
+#include "output_buffer.h"
+#include "query.h"
+#include <cstddef>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Database that many threads can use at once. The dates are split by range
+// into shards, each a Database behind its own reader-writer lock: a single
+// date locks one shard, a query the shards its date range overlaps. Every
+// operation sees and leaves the same entries, in the same order, as it
+// would on a single Database.
+//
+// Shards are always locked in date order and after the event dictionary's
+// lock, which is taken exclusively only to intern a new name. Logs and
+// snapshots are left to Database.
+class ShardedDatabase {
+public:
+  // Splits `range` into `shards` ranges of equal width; dates before or
+  // after it go to the first or the last shard.
+  ShardedDatabase(size_t shards, const DateRange &range);
+  ShardedDatabase(const ShardedDatabase &) = delete;
+  ShardedDatabase &operator=(const ShardedDatabase &) = delete;
+
+  size_t GetShardCount() const { return shards_.size(); }
+  void EnableEventIndex(bool enabled);
+
+  void Add(const Date &date, std::string_view event);
+  bool DeleteEvent(const Date &date, const std::string &event);
+  int DeleteDate(const Date &date);
+  std::string Last(const Date &date) const;
+  void Print(std::ostream &out) const;
+  void Print(OutputBuffer &out) const;
+
+  int RemoveIf(const Query &query);
+  std::vector<std::string> FindIf(const Query &query) const;
+  // See Database::ForEachIf. The visitor runs with the shards locked, so it
+  // must not call back into this database.
+  template <typename Visitor>
+  int ForEachIf(const Query &query, Visitor visitor) const {
+    const auto dictionary_lock = LockEventDictionary();
+    const auto [first, last] = ShardsOf(query.dates);
+    const auto locks =
+        LockShards<std::shared_lock<std::shared_mutex>>(first, last);
+    int count = 0;
+    for (size_t i = first; i < last; ++i) {
+      count += shards_[i].db.ForEachIf(query, visitor);
+    }
+    return count;
+  }
+
+private:
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    Database db;
+  };
+
+  size_t ShardOf(const Date &date) const;
+  // Shards [first, last) that dates of `range` fall into.
+  std::pair<size_t, size_t> ShardsOf(const DateRange &range) const;
+  // In order, so that threads locking several shards never deadlock.
+  template <typename Lock>
+  std::vector<Lock> LockShards(size_t first, size_t last) const {
+    std::vector<Lock> locks;
+    locks.reserve(last - first);
+    for (size_t i = first; i < last; ++i) {
+      locks.emplace_back(shards_[i].mutex);
+    }
+    return locks;
+  }
+
+  // First date of every shard but the first.
+  std::vector<Date> boundaries_;
+  std::vector<Shard> shards_;
+};
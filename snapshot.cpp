@@ -0,0 +1,502 @@
+#include "snapshot.h"
+#include "checksum.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+constexpr char kMagic[8] = {'D', 'B', 'S', 'N', 'A', 'P', '\r', '\n'};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  SnapshotEncoding encoding;
+  uint64_t log_position;
+  uint64_t date_count;
+  uint64_t event_count;
+  uint64_t name_count;
+  uint64_t name_bytes;
+  uint64_t chunk_count;
+  uint64_t data_bytes;
+};
+
+uint64_t Align(uint64_t offset) { return (offset + 7) & ~uint64_t{7}; }
+
+// Where every section starts, derived from the sizes in the header.
+struct Layout {
+  explicit Layout(const Header &header) {
+    const bool plain = header.encoding == SnapshotEncoding::Plain;
+    dates = sizeof(Header);
+    offsets = Align(dates + (plain ? 4 * header.date_count : 0));
+    events = offsets + (plain ? 8 * (header.date_count + 1) : 0);
+    name_offsets = Align(events + (plain ? 4 * header.event_count : 0));
+    names = name_offsets + 8 * (header.name_count + 1);
+    chunks = Align(names + header.name_bytes);
+    data = chunks + sizeof(SnapshotChunk) * header.chunk_count;
+    checksum = Align(data + header.data_bytes);
+    size = checksum + 8;
+  }
+
+  uint64_t dates, offsets, events, name_offsets, names, chunks, data,
+      checksum, size;
+};
+
+// Appends to the file, keeping count of the bytes written.
+class Writer {
+public:
+  explicit Writer(const string &path) : out_(path, ios::binary) {
+    if (!out_) {
+      throw runtime_error("Can't open " + path);
+    }
+  }
+
+  void Write(const void *data, size_t size) {
+    out_.write(static_cast<const char *>(data), size);
+    written_ += size;
+  }
+  template <typename T> void Write(const vector<T> &column) {
+    Write(column.data(), column.size() * sizeof(T));
+  }
+  void PadTo(uint64_t offset) {
+    static const char zeros[8] = {};
+    Write(zeros, offset - written_);
+  }
+  void Finish(const string &path) {
+    out_.close();
+    // The snapshot may replace log records, so it has to be on disk first.
+    const int fd = open(path.c_str(), O_RDONLY);
+    const bool synced = fd >= 0 && fsync(fd) == 0;
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (!out_ || !synced) {
+      throw runtime_error("Can't write " + path);
+    }
+  }
+
+private:
+  ofstream out_;
+  uint64_t written_ = 0;
+};
+
+[[noreturn]] void Corrupt(const string &what) {
+  throw CorruptSnapshot("Corrupt snapshot: " + what);
+}
+
+template <typename T> const T *Column(const char *data, uint64_t offset) {
+  return reinterpret_cast<const T *>(data + offset);
+}
+
+void PutVarint(string &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    out.push_back(static_cast<char>(value | 0x80));
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+// Dates [first, end) with their offsets, end's included, and their events.
+uint64_t ChunkChecksum(const int32_t *dates, const uint64_t *offsets,
+                       const uint32_t *events, size_t first, size_t end) {
+  uint64_t hash = Fnv1a(dates + first, (end - first) * sizeof(*dates));
+  hash = Fnv1a(offsets + first, (end - first + 1) * sizeof(*offsets), hash);
+  return Fnv1a(events + offsets[first],
+               (offsets[end] - offsets[first]) * sizeof(*events), hash);
+}
+
+// Appends dates [first, end) in the compressed encoding.
+void CompressChunk(const SnapshotColumns &columns, size_t first, size_t end,
+                   string &out) {
+  const uint32_t *events = columns.events.data() + columns.offsets[first];
+  const size_t event_count = columns.offsets[end] - columns.offsets[first];
+  vector<uint32_t> dictionary(events, events + event_count);
+  sort(dictionary.begin(), dictionary.end());
+  dictionary.erase(unique(dictionary.begin(), dictionary.end()),
+                   dictionary.end());
+  PutVarint(out, dictionary.size());
+  for (size_t i = 0; i < dictionary.size(); ++i) {
+    PutVarint(out, dictionary[i] - (i > 0 ? dictionary[i - 1] : 0));
+  }
+  for (size_t i = first; i < end; ++i) {
+    if (i > first) {
+      PutVarint(out, static_cast<int64_t>(columns.dates[i]) -
+                         columns.dates[i - 1]);
+    }
+    PutVarint(out, columns.offsets[i + 1] - columns.offsets[i]);
+    for (uint64_t j = columns.offsets[i]; j < columns.offsets[i + 1]; ++j) {
+      PutVarint(out, lower_bound(dictionary.begin(), dictionary.end(),
+                                 columns.events[j]) -
+                         dictionary.begin());
+    }
+  }
+}
+
+uint64_t DictionaryChecksum(const Header &header, const uint64_t *name_offsets,
+                            const char *names, const SnapshotChunk *chunks) {
+  uint64_t hash = Fnv1a(&header, sizeof(header));
+  hash = Fnv1a(name_offsets, (header.name_count + 1) * sizeof(*name_offsets),
+               hash);
+  hash = Fnv1a(names, header.name_bytes, hash);
+  return Fnv1a(chunks, header.chunk_count * sizeof(*chunks), hash);
+}
+} // namespace
+
+void WriteSnapshot(const string &path, const SnapshotColumns &columns,
+                   SnapshotEncoding encoding, size_t chunk_events) {
+  Header header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kSnapshotVersion;
+  header.encoding = encoding;
+  header.log_position = columns.log_position;
+  header.date_count = columns.dates.size();
+  header.event_count = columns.events.size();
+  header.name_count = columns.names.size();
+  vector<uint64_t> name_offsets{0};
+  for (string_view name : columns.names) {
+    name_offsets.push_back(name_offsets.back() + name.size());
+  }
+  header.name_bytes = name_offsets.back();
+
+  vector<SnapshotChunk> chunks;
+  for (size_t i = 0; i < columns.dates.size(); ++i) {
+    if (chunks.empty() ||
+        columns.offsets[i] - chunks.back().first_event >= chunk_events) {
+      chunks.push_back({i, columns.offsets[i], 0, 0, columns.dates[i], 0});
+    }
+  }
+  string data;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const size_t end = i + 1 < chunks.size() ? chunks[i + 1].first_date
+                                             : columns.dates.size();
+    if (encoding == SnapshotEncoding::Plain) {
+      chunks[i].checksum =
+          ChunkChecksum(columns.dates.data(), columns.offsets.data(),
+                        columns.events.data(), chunks[i].first_date, end);
+    } else {
+      chunks[i].data_offset = data.size();
+      CompressChunk(columns, chunks[i].first_date, end, data);
+      chunks[i].checksum = Fnv1a(data.data() + chunks[i].data_offset,
+                                 data.size() - chunks[i].data_offset);
+    }
+  }
+  header.chunk_count = chunks.size();
+  header.data_bytes = data.size();
+  const Layout layout(header);
+  string names;
+  names.reserve(header.name_bytes);
+  for (string_view name : columns.names) {
+    names.append(name);
+  }
+  const uint64_t checksum = DictionaryChecksum(
+      header, name_offsets.data(), names.data(), chunks.data());
+
+  const string temporary = path + ".tmp";
+  Writer writer(temporary);
+  writer.Write(&header, sizeof(header));
+  if (encoding == SnapshotEncoding::Plain) {
+    writer.Write(columns.dates);
+    writer.PadTo(layout.offsets);
+    writer.Write(columns.offsets);
+    writer.Write(columns.events);
+  }
+  writer.PadTo(layout.name_offsets);
+  writer.Write(name_offsets);
+  writer.Write(names.data(), names.size());
+  writer.PadTo(layout.chunks);
+  writer.Write(chunks);
+  writer.Write(data.data(), data.size());
+  writer.PadTo(layout.checksum);
+  writer.Write(&checksum, sizeof(checksum));
+  writer.Finish(temporary);
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    throw runtime_error("Can't write " + path);
+  }
+  // Callers drop what the snapshot replaces once this returns.
+  SyncDirectory(path);
+}
+
+SnapshotView ParseSnapshot(const char *data, size_t size,
+                           SnapshotCheck check) {
+  Header header;
+  if (size < sizeof(header)) {
+    Corrupt("too short");
+  }
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    Corrupt("bad magic");
+  }
+  if (header.version != kSnapshotVersion) {
+    Corrupt("unsupported version " + to_string(header.version));
+  }
+  if (header.encoding != SnapshotEncoding::Plain &&
+      header.encoding != SnapshotEncoding::Compressed) {
+    Corrupt("unknown encoding");
+  }
+  // Bounding the sizes first keeps the layout arithmetic from overflowing.
+  if (header.date_count > size || header.event_count > size ||
+      header.name_count > size || header.name_bytes > size ||
+      header.chunk_count > size || header.data_bytes > size) {
+    Corrupt("bad section sizes");
+  }
+  const Layout layout(header);
+  if (layout.size != size) {
+    Corrupt("bad file size");
+  }
+
+  SnapshotView view;
+  view.log_position = header.log_position;
+  view.encoding = header.encoding;
+  view.date_count = header.date_count;
+  view.event_count = header.event_count;
+  if (header.encoding == SnapshotEncoding::Plain) {
+    view.dates = Column<int32_t>(data, layout.dates);
+    view.offsets = Column<uint64_t>(data, layout.offsets);
+    view.events = Column<uint32_t>(data, layout.events);
+  }
+  view.name_offsets = Column<uint64_t>(data, layout.name_offsets);
+  view.name_count = header.name_count;
+  view.names = data + layout.names;
+  view.chunks = Column<SnapshotChunk>(data, layout.chunks);
+  view.chunk_count = header.chunk_count;
+  view.data = Column<uint8_t>(data, layout.data);
+  view.data_size = header.data_bytes;
+  if (check == SnapshotCheck::Header) {
+    return view;
+  }
+
+  uint64_t checksum;
+  memcpy(&checksum, data + layout.checksum, sizeof(checksum));
+  if (DictionaryChecksum(header, view.name_offsets, view.names,
+                         view.chunks) != checksum) {
+    Corrupt("checksum mismatch");
+  }
+  if (view.name_offsets[0] != 0 ||
+      view.name_offsets[view.name_count] != header.name_bytes) {
+    Corrupt("bad name offsets");
+  }
+  for (size_t i = 0; i < view.name_count; ++i) {
+    if (view.name_offsets[i] > view.name_offsets[i + 1]) {
+      Corrupt("bad name offsets");
+    }
+  }
+  // Every date and event belongs to exactly one chunk, and a chunk's bytes
+  // end where the next one's start.
+  if ((view.chunk_count == 0) != (view.date_count == 0)) {
+    Corrupt("bad chunk table");
+  }
+  for (size_t i = 0; i < view.chunk_count; ++i) {
+    const SnapshotChunk &chunk = view.chunks[i];
+    const SnapshotChunk *previous = i > 0 ? &view.chunks[i - 1] : nullptr;
+    if (chunk.first_date >= view.ChunkEnd(i) ||
+        chunk.first_event >= view.ChunkEventsEnd(i) ||
+        chunk.data_offset >= max<size_t>(view.data_size, 1) ||
+        (previous == nullptr
+             ? chunk.first_date != 0 || chunk.first_event != 0 ||
+                   chunk.data_offset != 0
+             : chunk.first_key <= previous->first_key ||
+                   chunk.data_offset < previous->data_offset)) {
+      Corrupt("bad chunk table");
+    }
+  }
+  if (view.encoding == SnapshotEncoding::Plain &&
+      (view.offsets[0] != 0 ||
+       view.offsets[view.date_count] != view.event_count)) {
+    Corrupt("bad event offsets");
+  }
+  if (check == SnapshotCheck::All) {
+    for (size_t i = 0; i < view.chunk_count; ++i) {
+      VerifySnapshotChunk(view, i);
+    }
+  }
+  return view;
+}
+
+SnapshotChunkReader::SnapshotChunkReader(const SnapshotView &view,
+                                         size_t chunk)
+    : view_(view), chunk_(chunk), date_(view.chunks[chunk].first_date),
+      end_(view.ChunkEnd(chunk)),
+      next_event_(view.chunks[chunk].first_event) {
+  if (view.encoding == SnapshotEncoding::Plain) {
+    // The checksum covers the events the offsets point at.
+    if (view.offsets[date_] != next_event_ ||
+        view.offsets[end_] != view.ChunkEventsEnd(chunk)) {
+      Corrupt("bad event offsets");
+    }
+    if (ChunkChecksum(view.dates, view.offsets, view.events, date_, end_) !=
+        view.chunks[chunk].checksum) {
+      Corrupt("chunk checksum mismatch");
+    }
+    return;
+  }
+  position_ = view.data + view.chunks[chunk].data_offset;
+  data_end_ = chunk + 1 < view.chunk_count
+                  ? view.data + view.chunks[chunk + 1].data_offset
+                  : view.data + view.data_size;
+  if (Fnv1a(position_, data_end_ - position_) != view.chunks[chunk].checksum) {
+    Corrupt("chunk checksum mismatch");
+  }
+  const uint64_t size = ReadVarint();
+  if (size == 0 || size > view.name_count) {
+    Corrupt("bad chunk dictionary");
+  }
+  dictionary_.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    const uint64_t id = ReadVarint() + (i > 0 ? dictionary_[i - 1] : 0);
+    if ((i > 0 && id == dictionary_[i - 1]) || id >= view.name_count) {
+      Corrupt("bad chunk dictionary");
+    }
+    dictionary_[i] = id;
+  }
+}
+
+bool SnapshotChunkReader::Next() {
+  if (date_ == end_) {
+    // The last date of the chunk still has to come before the next chunk.
+    if ((chunk_ + 1 < view_.chunk_count &&
+         key_ >= view_.chunks[chunk_ + 1].first_key) ||
+        next_event_ != view_.ChunkEventsEnd(chunk_) ||
+        position_ != data_end_) {
+      Corrupt("bad chunk end");
+    }
+    return false;
+  }
+
+  const bool first = date_ == view_.chunks[chunk_].first_date;
+  uint64_t count;
+  if (view_.encoding == SnapshotEncoding::Plain) {
+    if (view_.offsets[date_] != next_event_ ||
+        view_.offsets[date_ + 1] <= view_.offsets[date_]) {
+      Corrupt("bad event offsets");
+    }
+    if (first ? view_.dates[date_] != view_.chunks[chunk_].first_key
+              : view_.dates[date_] <= key_) {
+      Corrupt("dates out of order");
+    }
+    key_ = view_.dates[date_];
+    count = view_.offsets[date_ + 1] - view_.offsets[date_];
+  } else if (first) {
+    key_ = view_.chunks[chunk_].first_key;
+    count = ReadVarint();
+  } else {
+    const uint64_t delta = ReadVarint();
+    if (delta == 0 ||
+        delta > static_cast<uint64_t>(INT32_MAX - int64_t{key_})) {
+      Corrupt("dates out of order");
+    }
+    key_ += static_cast<int32_t>(delta);
+    count = ReadVarint();
+  }
+  // A date without events is never stored.
+  if (count == 0 || count > view_.ChunkEventsEnd(chunk_) - next_event_) {
+    Corrupt("bad event offsets");
+  }
+
+  event_count_ = count;
+  if (view_.encoding == SnapshotEncoding::Plain) {
+    events_ = view_.events + next_event_;
+    for (size_t i = 0; i < count; ++i) {
+      if (events_[i] >= view_.name_count) {
+        Corrupt("event id out of range");
+      }
+    }
+  } else {
+    decoded_.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      const uint64_t index = ReadVarint();
+      if (index >= dictionary_.size()) {
+        Corrupt("event id out of range");
+      }
+      decoded_[i] = dictionary_[index];
+    }
+    events_ = decoded_.data();
+  }
+  next_event_ += count;
+  ++date_;
+  return true;
+}
+
+uint64_t SnapshotChunkReader::ReadVarint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (position_ == data_end_) {
+      break;
+    }
+    const uint8_t byte = *position_++;
+    value |= uint64_t{byte & 0x7fu} << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+  Corrupt("bad varint");
+}
+
+void VerifySnapshotChunk(const SnapshotView &view, size_t chunk) {
+  SnapshotChunkReader reader(view, chunk);
+  while (reader.Next()) {
+  }
+}
+
+vector<char> ReadFile(const string &path) {
+  ifstream in(path, ios::binary | ios::ate);
+  if (!in) {
+    throw runtime_error("Can't open " + path);
+  }
+  vector<char> data(static_cast<size_t>(in.tellg()));
+  in.seekg(0);
+  if (!in.read(data.data(), data.size())) {
+    throw runtime_error("Can't read " + path);
+  }
+  return data;
+}
+
+MappedFile::MappedFile(const string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("Can't open " + path);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    throw runtime_error("Can't read " + path);
+  }
+  size_ = status.st_size;
+  if (size_ > 0) {
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("Can't map " + path);
+    }
+    data_ = static_cast<const char *>(data);
+  }
+  // The mapping keeps the file alive on its own.
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+void SyncDirectory(const string &path) {
+  const size_t slash = path.rfind('/');
+  string directory = ".";
+  if (slash != string::npos) {
+    directory = path.substr(0, max<size_t>(slash, 1));
+  }
+  const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+  const bool synced = fd >= 0 && fsync(fd) == 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!synced) {
+    throw runtime_error("Can't sync " + directory);
+  }
+}
@@ -0,0 +1,223 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary image of a Database, in host byte order:
+//   header    magic, format version, encoding, log position and the sizes
+//             of the sections below
+//   dates     int32 date keys, strictly increasing
+//   offsets   uint64 per date plus one: the events of dates[i] are
+//             events[offsets[i]] .. events[offsets[i + 1] - 1], in
+//             insertion order
+//   events    uint32 ids into the snapshot's own name dictionary
+//   names     uint64 offsets per name plus one into the name bytes, then
+//             the bytes themselves
+//   chunks    per chunk where its dates, events and bytes start, its first
+//             date key and a checksum of its contents
+//   data      compressed chunks, see below
+//   checksum  of the header, the names and the chunk table
+// Every section starts 8-byte aligned, so a buffer holding the whole file
+// can be read in place. Chunks split the dates into ranges of about
+// kSnapshotChunkEvents events that can be checked and decoded on their own.
+// A plain snapshot has the dates, offsets and events columns and no data;
+// a compressed one has data instead, each chunk holding as varints:
+//   its dictionary: the number of names, then their ids, delta-encoded
+//   per date: its key minus the previous one (nothing for the first), the
+//             number of events, then each event's index in the dictionary
+// The log position is the last write-ahead log record the snapshot holds.
+// Checksums are 64-bit FNV-1a.
+constexpr uint32_t kSnapshotVersion = 4;
+constexpr size_t kSnapshotChunkEvents = 1 << 16;
+
+enum class SnapshotEncoding : uint32_t { Plain, Compressed };
+
+// Thrown when a snapshot's contents fail a check, with a message starting
+// "Corrupt snapshot: ".
+class CorruptSnapshot : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Columns to write, filled by the caller.
+struct SnapshotColumns {
+  uint64_t log_position = 0;
+  std::vector<int32_t> dates;
+  std::vector<uint64_t> offsets;
+  std::vector<uint32_t> events;
+  std::vector<std::string_view> names;
+};
+
+// Writes and syncs a temporary file next to `path`, renames it over `path`
+// and syncs the directory. After a crash `path` holds either the old
+// snapshot or all of the new one, the new one for certain once this has
+// returned; the temporary file may be left behind, to be replaced by the
+// next write.
+void WriteSnapshot(const std::string &path, const SnapshotColumns &columns,
+                   SnapshotEncoding encoding = SnapshotEncoding::Plain,
+                   size_t chunk_events = kSnapshotChunkEvents);
+
+struct SnapshotChunk {
+  uint64_t first_date;
+  uint64_t first_event;
+  // Into the data section; 0 for a plain snapshot.
+  uint64_t data_offset;
+  uint64_t checksum;
+  int32_t first_key;
+  uint32_t reserved;
+};
+
+// Sections of a snapshot, pointing into the buffer it was parsed from. The
+// columns are null in a compressed one.
+struct SnapshotView {
+  uint64_t log_position = 0;
+  SnapshotEncoding encoding = SnapshotEncoding::Plain;
+  const int32_t *dates = nullptr;
+  size_t date_count = 0;
+  const uint64_t *offsets = nullptr;
+  const uint32_t *events = nullptr;
+  size_t event_count = 0;
+  const uint64_t *name_offsets = nullptr;
+  size_t name_count = 0;
+  const char *names = nullptr;
+  const SnapshotChunk *chunks = nullptr;
+  size_t chunk_count = 0;
+  const uint8_t *data = nullptr;
+  size_t data_size = 0;
+
+  std::string_view Name(uint32_t id) const {
+    return {names + name_offsets[id], name_offsets[id + 1] - name_offsets[id]};
+  }
+  // One past the last date of the chunk.
+  size_t ChunkEnd(size_t chunk) const {
+    return chunk + 1 < chunk_count ? chunks[chunk + 1].first_date
+                                   : date_count;
+  }
+  // One past the last event of the chunk.
+  size_t ChunkEventsEnd(size_t chunk) const {
+    return chunk + 1 < chunk_count ? chunks[chunk + 1].first_event
+                                   : event_count;
+  }
+};
+
+// How much of a snapshot ParseSnapshot checks.
+enum class SnapshotCheck {
+  // Only the header and the file size, reading no page past the header.
+  Header,
+  // Also the checksum, the names and the chunk table; the chunks are left
+  // to SnapshotChunkReader.
+  Dictionary,
+  All,
+};
+
+// Throws CorruptSnapshot if a check fails. Columns that are not checked
+// are trusted as written.
+SnapshotView ParseSnapshot(const char *data, size_t size,
+                           SnapshotCheck check = SnapshotCheck::All);
+
+// Reads the dates of one chunk in order, in either encoding, checking them
+// on the way: the checksum up front, then each date and its events as it
+// is read. Throws like ParseSnapshot.
+class SnapshotChunkReader {
+public:
+  SnapshotChunkReader(const SnapshotView &view, size_t chunk);
+
+  // Moves to the next date; false once past the last one.
+  bool Next();
+  int32_t DateKey() const { return key_; }
+  // Snapshot name ids of the date's events, in insertion order.
+  const uint32_t *Events() const { return events_; }
+  size_t EventCount() const { return event_count_; }
+
+private:
+  uint64_t ReadVarint();
+
+  const SnapshotView &view_;
+  size_t chunk_;
+  size_t date_;
+  size_t end_;
+  uint64_t next_event_;
+  int32_t key_ = 0;
+  const uint32_t *events_ = nullptr;
+  size_t event_count_ = 0;
+  // Compressed chunks only.
+  const uint8_t *position_ = nullptr;
+  const uint8_t *data_end_ = nullptr;
+  std::vector<uint32_t> dictionary_;
+  std::vector<uint32_t> decoded_;
+};
+
+// Reads the whole chunk, see SnapshotChunkReader.
+void VerifySnapshotChunk(const SnapshotView &view, size_t chunk);
+
+// Events of dates[index] of a snapshot, translated to ids of another
+// dictionary through `ids`, which is indexed by snapshot name id.
+class SnapshotBucket {
+public:
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = uint32_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const uint32_t *;
+    using reference = uint32_t;
+
+    Iterator(const uint32_t *event, const uint32_t *ids)
+        : event_(event), ids_(ids) {}
+    uint32_t operator*() const { return ids_[*event_]; }
+    Iterator &operator++() {
+      ++event_;
+      return *this;
+    }
+    bool operator==(const Iterator &other) const {
+      return event_ == other.event_;
+    }
+    bool operator!=(const Iterator &other) const {
+      return event_ != other.event_;
+    }
+
+  private:
+    const uint32_t *event_;
+    const uint32_t *ids_;
+  };
+
+  SnapshotBucket(const SnapshotView &view, size_t index, const uint32_t *ids)
+      : begin_(view.events + view.offsets[index]),
+        end_(view.events + view.offsets[index + 1]), ids_(ids) {}
+
+  Iterator begin() const { return {begin_, ids_}; }
+  Iterator end() const { return {end_, ids_}; }
+  size_t size() const { return end_ - begin_; }
+  uint32_t back() const { return ids_[end_[-1]]; }
+
+private:
+  const uint32_t *begin_;
+  const uint32_t *end_;
+  const uint32_t *ids_;
+};
+
+// Read-only mapping of a whole file; pages are read in only as they are
+// touched.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+std::vector<char> ReadFile(const std::string &path);
+// Syncs the directory holding `path`, so that a file renamed into it or
+// removed from it stays so after a crash.
+void SyncDirectory(const std::string &path);
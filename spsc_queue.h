@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded queue between exactly one producer thread and one consumer
+// thread. Neither side locks to move items: each advances only its own
+// index and reads the other's, keeping a stale copy of it so that the
+// shared cache line is read only when the queue looks full or empty. A side
+// that has to wait spins briefly, then sleeps until the other side moves.
+template <typename T> class SpscQueue {
+public:
+  // Holds up to `capacity` items, rounded up to a power of two.
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  // Producer only. Moves from `value` and returns true unless full.
+  bool TryPush(T &value) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == slots_.size()) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == slots_.size()) {
+        return false;
+      }
+    }
+    slots_[tail & mask_] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Moves the oldest item into `value` and returns true
+  // unless empty.
+  bool TryPop(T &value) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) {
+        return false;
+      }
+    }
+    value = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Like TryPush and TryPop, but wait for room or an item. Both return
+  // false, without moving anything, once `stop` is set and Wake called.
+  bool Push(T &value, const std::atomic<bool> &stop) {
+    return Wait([&] { return TryPush(value); }, stop);
+  }
+  bool Pop(T &value, const std::atomic<bool> &stop) {
+    return Wait([&] { return TryPop(value); }, stop);
+  }
+
+  // Wakes a sleeping Push or Pop to look at its stop flag.
+  void Wake() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    moved_.notify_all();
+  }
+
+private:
+  static constexpr int kSpins = 64;
+
+  template <typename Attempt>
+  bool Wait(Attempt attempt, const std::atomic<bool> &stop) {
+    for (int i = 0; i < kSpins; ++i) {
+      if (attempt()) {
+        Notify();
+        return true;
+      }
+      if (stop.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    // Either the other side sees the sleeper or this sees its move.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool moved;
+    while (!(moved = attempt()) && !stop.load()) {
+      moved_.wait(lock);
+    }
+    sleepers_.fetch_sub(1);
+    lock.unlock();
+    if (moved) {
+      Notify();
+    }
+    return moved;
+  }
+
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) > 0) {
+      Wake();
+    }
+  }
+
+  std::vector<T> slots_;
+  size_t mask_;
+  // Count of items ever popped, written by the consumer.
+  alignas(64) std::atomic<size_t> head_{0};
+  size_t tail_cache_ = 0;
+  // Count of items ever pushed, written by the producer.
+  alignas(64) std::atomic<size_t> tail_{0};
+  size_t head_cache_ = 0;
+
+  // Only for sleeping; items move without it.
+  alignas(64) std::atomic<int> sleepers_{0};
+  std::mutex mutex_;
+  std::condition_variable moved_;
+};
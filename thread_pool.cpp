@@ -0,0 +1,128 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t workers) {
+  for (size_t i = 0; i < workers; ++i) {
+    workers_.emplace_back([this] { Work(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+namespace {
+uint64_t Slice(uint64_t begin, uint64_t end) { return begin << 32 | end; }
+uint64_t Begin(uint64_t slice) { return slice >> 32; }
+uint64_t End(uint64_t slice) { return slice & UINT32_MAX; }
+} // namespace
+
+void ThreadPool::ParallelFor(size_t count, function<void(size_t)> body) {
+  if (count == 0) {
+    return;
+  }
+  if (count > UINT32_MAX) {
+    throw length_error("ParallelFor over more than 2^32 indices");
+  }
+  const size_t participants = count > 1 ? workers_.size() + 1 : 1;
+  auto job = make_shared<Job>(participants);
+  job->body = move(body);
+  job->remaining = count;
+  for (size_t i = 0; i < participants; ++i) {
+    job->slices[i] =
+        Slice(count * i / participants, count * (i + 1) / participants);
+  }
+  if (participants > 1) {
+    {
+      lock_guard<mutex> lock(mutex_);
+      job_ = job;
+      ++generation_;
+    }
+    wake_.notify_all();
+  }
+  Run(*job, 0);
+  unique_lock<mutex> lock(job->mutex);
+  job->done.wait(lock, [&job] { return job->remaining == 0; });
+  if (job->error) {
+    rethrow_exception(job->error);
+  }
+}
+
+void ThreadPool::Run(Job &job, size_t participant) {
+  for (size_t i; Take(job, participant, i);) {
+    try {
+      job.body(i);
+    } catch (...) {
+      lock_guard<mutex> lock(job.mutex);
+      if (!job.error) {
+        job.error = current_exception();
+      }
+    }
+    if (--job.remaining == 0) {
+      lock_guard<mutex> lock(job.mutex);
+      job.done.notify_all();
+    }
+  }
+}
+
+bool ThreadPool::Take(Job &job, size_t participant, size_t &index) {
+  auto &own = job.slices[participant];
+  for (uint64_t slice = own.load(); Begin(slice) < End(slice);) {
+    if (own.compare_exchange_weak(slice,
+                                  Slice(Begin(slice) + 1, End(slice)))) {
+      index = Begin(slice);
+      return true;
+    }
+  }
+  const size_t participants = job.slices.size();
+  for (size_t i = 1; i < participants; ++i) {
+    auto &victim = job.slices[(participant + i) % participants];
+    for (uint64_t slice = victim.load(); Begin(slice) < End(slice);) {
+      const uint64_t middle = End(slice) - (End(slice) - Begin(slice) + 1) / 2;
+      if (victim.compare_exchange_weak(slice,
+                                       Slice(Begin(slice), middle))) {
+        // Only the owner refills its own slice, and thieves leave an
+        // empty one alone.
+        own.store(Slice(middle + 1, End(slice)));
+        index = middle;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void ThreadPool::Work() {
+  unique_lock<mutex> lock(mutex_);
+  uint64_t seen = 0;
+  while (true) {
+    wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+    if (stop_) {
+      return;
+    }
+    seen = generation_;
+    // A worker that wakes late finds the job's indices all taken.
+    const shared_ptr<Job> job = job_;
+    lock.unlock();
+    const size_t participant = job->next_participant++;
+    if (participant < job->slices.size()) {
+      Run(*job, participant);
+    }
+    lock.lock();
+  }
+}
+
+ThreadPool &GetThreadPool() {
+  static ThreadPool pool(max(1u, thread::hardware_concurrency()) - 1);
+  return pool;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run the iterations of ParallelFor
+// together with the calling thread.
+class ThreadPool {
+public:
+  // `workers` threads besides the one calling ParallelFor.
+  explicit ThreadPool(size_t workers);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t GetConcurrency() const { return workers_.size() + 1; }
+
+  // Calls body(i) for every i in [0, count) and returns when all are done.
+  // Every thread starts on a contiguous slice of the indices, in order, and
+  // one that runs out steals the back half of another's remaining slice, so
+  // neighbouring indices mostly run on one thread while uneven ones still
+  // balance. The first exception a call throws is rethrown here once the
+  // rest have finished. Not to be called from inside a body.
+  void ParallelFor(size_t count, std::function<void(size_t)> body);
+
+private:
+  struct Job {
+    explicit Job(size_t participants) : slices(participants) {}
+
+    std::function<void(size_t)> body;
+    // Indices [begin, end) each participant has left, as begin << 32 | end.
+    // The owner takes the front; thieves move the end.
+    std::vector<std::atomic<uint64_t>> slices;
+    // The caller is participant 0.
+    std::atomic<size_t> next_participant{1};
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+  };
+
+  static void Run(Job &job, size_t participant);
+  // Takes the next index of the participant's slice, refilling it from
+  // another's when empty; false once no work is left to take.
+  static bool Take(Job &job, size_t participant, size_t &index);
+  void Work();
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::shared_ptr<Job> job_;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// Shared pool with a thread per core.
+ThreadPool &GetThreadPool();
@@ -4,83 +4,79 @@
 
 using namespace std;
 
-vector<Token> Tokenize(istream &cl) {
-  vector<Token> tokens;
+namespace {
+bool IsSpace(char c) { return c == ' ' || ('\t' <= c && c <= '\r'); }
+bool IsDigit(char c) { return '0' <= c && c <= '9'; }
+} // namespace
 
-  char c;
-  while (cl >> c) {
-    if (isdigit(c)) {
-      string date(1, c);
+TokenIterator &TokenIterator::operator++() {
+  while (true) {
+    while (!rest_.empty() && IsSpace(rest_.front())) {
+      rest_.remove_prefix(1);
+    }
+    if (rest_.empty()) {
+      at_end_ = true;
+      return *this;
+    }
+    const string_view start = rest_;
+    const char c = rest_.front();
+    rest_.remove_prefix(1);
+    if (IsDigit(c)) {
+      // Three digit groups with one separator char after each of the
+      // first two, whatever that char is.
       for (int i = 0; i < 3; ++i) {
-        while (isdigit(cl.peek())) {
-          date += cl.get();
+        while (!rest_.empty() && IsDigit(rest_.front())) {
+          rest_.remove_prefix(1);
         }
-        if (i < 2) {
-          date += cl.get(); // Consume '-'
+        if (i < 2 && !rest_.empty()) {
+          rest_.remove_prefix(1); // Consume '-'
         }
       }
-      tokens.push_back({date, TokenType::DATE});
+      token_ = {start.substr(0, start.size() - rest_.size()), TokenType::DATE};
     } else if (c == '"') {
-      string event;
-      getline(cl, event, '"');
-      tokens.push_back({event, TokenType::EVENT});
+      const size_t quote = rest_.find('"');
+      token_ = {rest_.substr(0, quote), TokenType::EVENT};
+      rest_.remove_prefix(quote == string_view::npos ? rest_.size()
+                                                     : quote + 1);
     } else if (c == 'd') {
-      if (cl.get() == 'a' && cl.get() == 't' && cl.get() == 'e') {
-        tokens.push_back({"date", TokenType::COLUMN});
-      } else {
-        throw logic_error("Unknown token");
-      }
+      ExpectKeyword("date", TokenType::COLUMN);
     } else if (c == 'e') {
-      if (cl.get() == 'v' && cl.get() == 'e' && cl.get() == 'n' &&
-          cl.get() == 't') {
-        tokens.push_back({"event", TokenType::COLUMN});
-      } else {
-        throw logic_error("Unknown token");
-      }
+      ExpectKeyword("event", TokenType::COLUMN);
     } else if (c == 'A') {
-      if (cl.get() == 'N' && cl.get() == 'D') {
-        tokens.push_back({"AND", TokenType::LOGICAL_OP});
-      } else {
-        throw logic_error("Unknown token");
-      }
+      ExpectKeyword("AND", TokenType::LOGICAL_OP);
     } else if (c == 'O') {
-      if (cl.get() == 'R') {
-        tokens.push_back({"OR", TokenType::LOGICAL_OP});
-      } else {
-        throw logic_error("Unknown token");
-      }
+      ExpectKeyword("OR", TokenType::LOGICAL_OP);
     } else if (c == '(') {
-      tokens.push_back({"(", TokenType::PAREN_LEFT});
+      token_ = {"(", TokenType::PAREN_LEFT};
     } else if (c == ')') {
-      tokens.push_back({")", TokenType::PAREN_RIGHT});
-    } else if (c == '<') {
-      if (cl.peek() == '=') {
-        cl.get();
-        tokens.push_back({"<=", TokenType::COMPARE_OP});
-      } else {
-        tokens.push_back({"<", TokenType::COMPARE_OP});
-      }
-    } else if (c == '>') {
-      if (cl.peek() == '=') {
-        cl.get();
-        tokens.push_back({">=", TokenType::COMPARE_OP});
-      } else {
-        tokens.push_back({">", TokenType::COMPARE_OP});
-      }
-    } else if (c == '=') {
-      if (cl.get() == '=') {
-        tokens.push_back({"==", TokenType::COMPARE_OP});
-      } else {
-        throw logic_error("Unknown token");
-      }
-    } else if (c == '!') {
-      if (cl.get() == '=') {
-        tokens.push_back({"!=", TokenType::COMPARE_OP});
-      } else {
-        throw logic_error("Unknown token");
+      token_ = {")", TokenType::PAREN_RIGHT};
+    } else if (c == '<' || c == '>') {
+      const bool or_equal = !rest_.empty() && rest_.front() == '=';
+      if (or_equal) {
+        rest_.remove_prefix(1);
       }
+      token_ = {start.substr(0, or_equal ? 2 : 1), TokenType::COMPARE_OP};
+    } else if (c == '=' || c == '!') {
+      ExpectKeyword(c == '=' ? "==" : "!=", TokenType::COMPARE_OP);
+    } else {
+      // Anything else is skipped, as it always was.
+      continue;
     }
+    return *this;
   }
+}
 
-  return tokens;
-}
\ No newline at end of file
+void TokenIterator::ExpectKeyword(string_view keyword, TokenType type) {
+  // Like reading with get(): chars are consumed up to the first mismatch.
+  for (size_t i = 1; i < keyword.size(); ++i) {
+    if (rest_.empty()) {
+      throw logic_error("Unknown token");
+    }
+    const char c = rest_.front();
+    rest_.remove_prefix(1);
+    if (c != keyword[i]) {
+      throw logic_error("Unknown token");
+    }
+  }
+  token_ = {keyword, type};
+}
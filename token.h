@@ -1,7 +1,6 @@
 #pragma once
 
-#include <sstream>
-#include <vector>
+#include <string_view>
 using namespace std;
 
 enum class TokenType {
@@ -15,8 +14,36 @@ enum class TokenType {
 };
 
 struct Token {
-  const string value;
-  const TokenType type;
+  string_view value;
+  TokenType type;
 };
 
-vector<Token> Tokenize(istream &cl);
\ No newline at end of file
+// Tokenizes a condition lazily, one token per increment. Token values are
+// views into the text, so the text has to outlive the tokens; nothing is
+// allocated. A default-constructed iterator marks the end.
+class TokenIterator {
+public:
+  TokenIterator() = default;
+  explicit TokenIterator(string_view text) : rest_(text), at_end_(false) {
+    ++*this;
+  }
+
+  const Token &operator*() const { return token_; }
+  const Token *operator->() const { return &token_; }
+  TokenIterator &operator++();
+
+  bool operator==(const TokenIterator &other) const {
+    return at_end_ && other.at_end_;
+  }
+  bool operator!=(const TokenIterator &other) const {
+    return !(*this == other);
+  }
+
+private:
+  // Consumes `keyword` after its first char, which was already taken.
+  void ExpectKeyword(string_view keyword, TokenType type);
+
+  string_view rest_;
+  Token token_{};
+  bool at_end_ = true;
+};
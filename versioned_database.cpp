@@ -0,0 +1,277 @@
+#include "versioned_database.h"
+#include <stdexcept>
+#include <unordered_set>
+
+using namespace std;
+
+struct VersionedDatabase::Transaction {
+  // Not published yet, so still changed in place.
+  unordered_set<const TrieNode *> created;
+  vector<const TrieNode *> replaced_nodes;
+  vector<const Bucket *> replaced_buckets;
+};
+
+VersionedDatabase::~VersionedDatabase() { Free(root_.load(), 0); }
+
+void VersionedDatabase::Add(const Date &date, string_view event) {
+  lock_guard<mutex> lock(write_mutex_);
+  auto &dictionary = GetEventDictionary();
+  EventId id;
+  {
+    shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+    id = dictionary.Find(event);
+  }
+  if (id == kNoEvent) {
+    // Readers only look up names they have seen, which never move.
+    unique_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+    id = dictionary.Intern(event);
+  }
+  const TrieNode *root = root_.load();
+  const Bucket *old = FindBucket(root, date);
+  if (old != nullptr && old->events.Contains(id)) {
+    return;
+  }
+  auto bucket = new Bucket{date, old != nullptr ? old->events : EventSet()};
+  bucket->events.Add(id);
+  Transaction transaction;
+  Publish(Assign(root, 0, date, bucket, transaction), transaction);
+}
+
+bool VersionedDatabase::DeleteEvent(const Date &date, const string &event) {
+  lock_guard<mutex> lock(write_mutex_);
+  EventId id;
+  {
+    shared_lock<shared_mutex> dictionary_lock(GetEventDictionaryMutex());
+    id = GetEventDictionary().Find(event);
+  }
+  const TrieNode *root = root_.load();
+  const Bucket *old = FindBucket(root, date);
+  if (old == nullptr || !old->events.Contains(id)) {
+    return false;
+  }
+  Bucket *bucket = nullptr;
+  if (old->events.Size() > 1) {
+    bucket = new Bucket{*old};
+    bucket->events.RemoveIf([id](EventId other) { return other == id; });
+  }
+  Transaction transaction;
+  Publish(Assign(root, 0, date, bucket, transaction), transaction);
+  return true;
+}
+
+int VersionedDatabase::DeleteDate(const Date &date) {
+  lock_guard<mutex> lock(write_mutex_);
+  const TrieNode *root = root_.load();
+  const Bucket *old = FindBucket(root, date);
+  if (old == nullptr) {
+    return 0;
+  }
+  const int count = old->events.Size();
+  Transaction transaction;
+  Publish(Assign(root, 0, date, nullptr, transaction), transaction);
+  return count;
+}
+
+int VersionedDatabase::RemoveIf(const Query &query) {
+  lock_guard<mutex> lock(write_mutex_);
+  ConditionProgram program = query.program;
+  {
+    const auto dictionary_lock = LockEventDictionary();
+    program.Bind(GetEventDictionary());
+  }
+  // The current version can't change under the writer, so it is read
+  // without pinning.
+  const TrieNode *root = root_.load();
+  vector<pair<Date, const Bucket *>> changes;
+  int count = 0;
+  auto remove = [&](const Bucket &old) {
+    const DateVerdict verdict = program.EvaluateDate(old.date);
+    if (verdict == DateVerdict::Accept) {
+      count += old.events.Size();
+      changes.emplace_back(old.date, nullptr);
+    } else if (verdict == DateVerdict::DependsOnEvent) {
+      Bucket bucket = old;
+      const int removed = bucket.events.RemoveIf([&](EventId event) {
+        return program.Evaluate(old.date, event);
+      });
+      if (removed > 0) {
+        count += removed;
+        changes.emplace_back(old.date, bucket.events.Empty()
+                                           ? nullptr
+                                           : new Bucket(move(bucket)));
+      }
+    }
+  };
+  VisitBuckets(root, query.dates, remove);
+  if (changes.empty()) {
+    return 0;
+  }
+  Transaction transaction;
+  for (const auto &[date, bucket] : changes) {
+    root = Assign(root, 0, date, bucket, transaction);
+  }
+  Publish(root, transaction);
+  return count;
+}
+
+VersionedDatabase::Snapshot VersionedDatabase::GetSnapshot() const {
+  EpochManager::Guard guard = epochs_.Pin();
+  return Snapshot(move(guard), root_.load());
+}
+
+size_t VersionedDatabase::GetRetiredCount() const {
+  lock_guard<mutex> lock(write_mutex_);
+  return epochs_.GetRetiredCount();
+}
+
+const VersionedDatabase::Bucket *
+VersionedDatabase::FindBucket(const TrieNode *root, const Date &date) {
+  const uint32_t key = TrieKey(date);
+  const void *slot = root;
+  for (int level = 0; level < kLevels && slot != nullptr; ++level) {
+    const int shift = kBits * (kLevels - 1 - level);
+    slot = static_cast<const TrieNode *>(slot)
+               ->slots[key >> shift & (kFanout - 1)];
+  }
+  return static_cast<const Bucket *>(slot);
+}
+
+const VersionedDatabase::Bucket *
+VersionedDatabase::FindLast(const TrieNode &node, int level, uint32_t key,
+                            bool bounded) {
+  const int shift = kBits * (kLevels - 1 - level);
+  const uint32_t start = bounded ? key >> shift & (kFanout - 1) : kFanout - 1;
+  for (uint32_t slot = start + 1; slot-- > 0;) {
+    const void *child = node.slots[slot];
+    if (child == nullptr) {
+      continue;
+    }
+    if (level == kLevels - 1) {
+      return static_cast<const Bucket *>(child);
+    }
+    const Bucket *last = FindLast(*static_cast<const TrieNode *>(child),
+                                  level + 1, key, bounded && slot == start);
+    if (last != nullptr) {
+      return last;
+    }
+  }
+  return nullptr;
+}
+
+const VersionedDatabase::TrieNode *
+VersionedDatabase::Assign(const TrieNode *node, int level, const Date &date,
+                          const Bucket *bucket, Transaction &transaction) {
+  TrieNode *copy;
+  if (node == nullptr) {
+    copy = new TrieNode();
+    transaction.created.insert(copy);
+  } else if (transaction.created.count(node) > 0) {
+    copy = const_cast<TrieNode *>(node);
+  } else {
+    copy = new TrieNode(*node);
+    transaction.created.insert(copy);
+    transaction.replaced_nodes.push_back(node);
+  }
+  const int shift = kBits * (kLevels - 1 - level);
+  const void *&slot = copy->slots[TrieKey(date) >> shift & (kFanout - 1)];
+  const void *old = slot;
+  if (level == kLevels - 1) {
+    if (old != nullptr) {
+      transaction.replaced_buckets.push_back(static_cast<const Bucket *>(old));
+    }
+    slot = bucket;
+  } else {
+    slot = Assign(static_cast<const TrieNode *>(old), level + 1, date, bucket,
+                  transaction);
+  }
+  copy->count += (slot != nullptr) - (old != nullptr);
+  if (copy->count > 0) {
+    return copy;
+  }
+  // Only a node of this transaction can end up empty.
+  transaction.created.erase(copy);
+  delete copy;
+  return nullptr;
+}
+
+void VersionedDatabase::Free(const TrieNode *node, int level) {
+  if (node == nullptr) {
+    return;
+  }
+  for (const void *child : node->slots) {
+    if (level == kLevels - 1) {
+      delete static_cast<const Bucket *>(child);
+    } else {
+      Free(static_cast<const TrieNode *>(child), level + 1);
+    }
+  }
+  delete node;
+}
+
+void VersionedDatabase::Publish(const TrieNode *root,
+                                Transaction &transaction) {
+  root_.store(root);
+  epochs_.Retire([nodes = move(transaction.replaced_nodes),
+                  buckets = move(transaction.replaced_buckets)] {
+    for (const TrieNode *node : nodes) {
+      delete node;
+    }
+    for (const Bucket *bucket : buckets) {
+      delete bucket;
+    }
+  });
+  epochs_.Collect();
+}
+
+vector<string> VersionedDatabase::Snapshot::FindIf(const Query &query) const {
+  vector<string> entries;
+  Date last_date;
+  string prefix;
+  ForEachIf(query, [&](const Date &date, string_view event) {
+    if (prefix.empty() || date != last_date) {
+      last_date = date;
+      prefix = date.getDate() + " ";
+    }
+    entries.emplace_back(prefix);
+    entries.back().append(event);
+  });
+  return entries;
+}
+
+string VersionedDatabase::Snapshot::Last(const Date &date) const {
+  const Bucket *last =
+      root_ != nullptr ? FindLast(*root_, 0, TrieKey(date), true) : nullptr;
+  if (last == nullptr) {
+    throw invalid_argument("Last not found");
+  }
+  return last->date.getDate() + " " +
+         GetEventDictionary().Name(last->events.GetAll().back());
+}
+
+void VersionedDatabase::Snapshot::Print(ostream &out) const {
+  OutputBuffer buffer(out);
+  Print(buffer);
+}
+
+void VersionedDatabase::Snapshot::Print(OutputBuffer &out) const {
+  const auto &dictionary = GetEventDictionary();
+  VisitBuckets(DateRange(), [&](const Bucket &bucket) {
+    for (EventId event : bucket.events.GetAll()) {
+      out << bucket.date << ' ' << dictionary.Name(event) << '\n';
+    }
+  });
+}
+
+ConditionProgram
+VersionedDatabase::Snapshot::BindQuery(const Query &query) const {
+  // Every name in this version was interned before it was published, so a
+  // table sorted since holds them all. Once taken, queries bind against it
+  // without the dictionary lock.
+  if (ranks_ == nullptr) {
+    const auto dictionary_lock = LockEventDictionary();
+    ranks_ = GetEventDictionary().GetRanks();
+  }
+  ConditionProgram program = query.program;
+  program.Bind(GetEventDictionary(), ranks_);
+  return program;
+}
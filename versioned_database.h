@@ -0,0 +1,169 @@
+#pragma once
+#include "date.h"
+#include "epoch.h"
+#include "event_dictionary.h"
+#include "event_set.h"
+#include "output_buffer.h"
+#include "query.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Database whose readers never wait for writers. Every date's events sit in
+// an immutable bucket reached through a persistent trie on the date key: a
+// write copies the buckets it changes and the trie nodes on the paths to
+// them, then publishes the new root at once. A reader pins the version
+// current at that moment and walks it without locks, while writers, one at
+// a time, keep publishing. Replaced buckets and nodes are freed by epoch-
+// based reclamation once no pinned reader can reach them.
+//
+// Entries, their order and the answers match Database. The event index,
+// logs and snapshot files are left to Database.
+class VersionedDatabase {
+  struct Bucket;
+  struct TrieNode;
+
+public:
+  // One version of the database, consistent however long it is held. Each
+  // thread takes its own; holding one delays reclaiming what later writes
+  // replace. Only its first query takes the dictionary lock.
+  class Snapshot {
+  public:
+    // See Database::ForEachIf.
+    template <typename Visitor>
+    int ForEachIf(const Query &query, Visitor visitor) const {
+      const ConditionProgram program = BindQuery(query);
+      const auto &dictionary = GetEventDictionary();
+      int count = 0;
+      VisitBuckets(query.dates, [&](const Bucket &bucket) {
+        const DateVerdict verdict = program.EvaluateDate(bucket.date);
+        if (verdict == DateVerdict::Reject) {
+          return;
+        }
+        for (EventId event : bucket.events.GetAll()) {
+          if (verdict == DateVerdict::Accept ||
+              program.Evaluate(bucket.date, event)) {
+            visitor(bucket.date, std::string_view(dictionary.Name(event)));
+            ++count;
+          }
+        }
+      });
+      return count;
+    }
+    std::vector<std::string> FindIf(const Query &query) const;
+    std::string Last(const Date &date) const;
+    void Print(std::ostream &out) const;
+    void Print(OutputBuffer &out) const;
+
+  private:
+    friend class VersionedDatabase;
+    Snapshot(EpochManager::Guard guard, const TrieNode *root)
+        : guard_(std::move(guard)), root_(root) {}
+
+    ConditionProgram BindQuery(const Query &query) const;
+    template <typename Visitor>
+    void VisitBuckets(const DateRange &dates, Visitor visitor) const {
+      VersionedDatabase::VisitBuckets(root_, dates, visitor);
+    }
+
+    EpochManager::Guard guard_;
+    const TrieNode *root_;
+    // Names as of the first query, which this thread's queries bind to.
+    mutable std::shared_ptr<const EventDictionary::RankTable> ranks_;
+  };
+
+  VersionedDatabase() = default;
+  ~VersionedDatabase();
+  VersionedDatabase(const VersionedDatabase &) = delete;
+  VersionedDatabase &operator=(const VersionedDatabase &) = delete;
+
+  void Add(const Date &date, std::string_view event);
+  bool DeleteEvent(const Date &date, const std::string &event);
+  int DeleteDate(const Date &date);
+  // Removes every matching entry in one new version.
+  int RemoveIf(const Query &query);
+
+  // Never waits: beyond EpochManager::kSlots snapshots held at once, each
+  // further kSlots cost a block of slots kept until destruction.
+  Snapshot GetSnapshot() const;
+  // Each on a snapshot of its own.
+  std::vector<std::string> FindIf(const Query &query) const {
+    return GetSnapshot().FindIf(query);
+  }
+  std::string Last(const Date &date) const { return GetSnapshot().Last(date); }
+  void Print(std::ostream &out) const { GetSnapshot().Print(out); }
+
+  // Replaced versions not freed yet, for tests and monitoring.
+  size_t GetRetiredCount() const;
+
+private:
+  // 16-way trie on the date key with the sign bit flipped, so that slot
+  // order is date order. Slots of the last level point at buckets.
+  static constexpr int kBits = 4;
+  static constexpr int kLevels = 32 / kBits;
+  static constexpr uint32_t kFanout = 1u << kBits;
+
+  struct Bucket {
+    Date date;
+    EventSet events;
+  };
+  struct TrieNode {
+    std::array<const void *, kFanout> slots{};
+    uint32_t count = 0;
+  };
+  // What one write created and replaced.
+  struct Transaction;
+
+  static uint32_t TrieKey(const Date &date) {
+    return static_cast<uint32_t>(date.GetKey()) ^ 0x80000000u;
+  }
+  static const Bucket *FindBucket(const TrieNode *root, const Date &date);
+  // The bucket with the greatest key up to `key`, where `bounded`.
+  static const Bucket *FindLast(const TrieNode &node, int level, uint32_t key,
+                                bool bounded);
+  // Calls visitor(const Bucket &) for the dates within `dates`, in order.
+  template <typename Visitor>
+  static void VisitBuckets(const TrieNode *root, const DateRange &dates,
+                           Visitor &visitor) {
+    if (!dates.Empty() && root != nullptr) {
+      Visit(*root, 0, 0, TrieKey(dates.first), TrieKey(dates.last), visitor);
+    }
+  }
+  template <typename Visitor>
+  static void Visit(const TrieNode &node, int level, uint32_t prefix,
+                    uint32_t first, uint32_t last, Visitor &visitor) {
+    const int shift = kBits * (kLevels - 1 - level);
+    for (uint32_t slot = 0; slot < kFanout; ++slot) {
+      const void *child = node.slots[slot];
+      const uint32_t low = prefix | slot << shift;
+      const uint32_t high = low | ((uint64_t{1} << shift) - 1);
+      if (child == nullptr || high < first || last < low) {
+        continue;
+      }
+      if (level == kLevels - 1) {
+        visitor(*static_cast<const Bucket *>(child));
+      } else {
+        Visit(*static_cast<const TrieNode *>(child), level + 1, low, first,
+              last, visitor);
+      }
+    }
+  }
+  // Returns the root with `bucket`, or nothing if null, at `date`.
+  static const TrieNode *Assign(const TrieNode *node, int level,
+                                const Date &date, const Bucket *bucket,
+                                Transaction &transaction);
+  static void Free(const TrieNode *node, int level);
+  // Makes `root` current and retires what the transaction replaced.
+  void Publish(const TrieNode *root, Transaction &transaction);
+
+  mutable EpochManager epochs_;
+  std::atomic<const TrieNode *> root_{nullptr};
+  // Serializes writers; readers never take it.
+  mutable std::mutex write_mutex_;
+};
@@ -0,0 +1,203 @@
+#include "wal.h"
+#include "checksum.h"
+#include "snapshot.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+// size, then checksum of the payload
+constexpr size_t kRecordHeader = sizeof(uint32_t) + sizeof(uint64_t);
+// position, op, date key, then the text
+constexpr size_t kPayloadHeader =
+    sizeof(uint64_t) + sizeof(uint8_t) + sizeof(int32_t);
+
+template <typename T> void Put(string &buffer, const T &value) {
+  buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> T Get(const char *data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+[[noreturn]] void Fail(const string &what, const string &path) {
+  throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const string &path, uint64_t valid_size,
+                             GroupCommitPolicy policy)
+    : path_(path),
+      fd_(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)),
+      policy_(policy), size_(valid_size) {
+  if (fd_ < 0) {
+    Fail("Can't open", path_);
+  }
+  if (ftruncate(fd_, valid_size) != 0) {
+    close(fd_);
+    Fail("Can't truncate", path_);
+  }
+  // Synced records of a log just created must not vanish with its entry.
+  try {
+    SyncDirectory(path_);
+  } catch (...) {
+    close(fd_);
+    throw;
+  }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  try {
+    Sync();
+  } catch (...) {
+  }
+  close(fd_);
+}
+
+void WriteAheadLog::Append(const LogRecord &record) {
+  const uint32_t payload_size = kPayloadHeader + record.text.size();
+  const size_t start = buffer_.size();
+  Put(buffer_, payload_size);
+  Put(buffer_, uint64_t{0});
+  Put(buffer_, record.position);
+  Put(buffer_, static_cast<uint8_t>(record.op));
+  Put(buffer_, record.date.GetKey());
+  buffer_.append(record.text);
+  size_ += buffer_.size() - start;
+  const uint64_t checksum =
+      Fnv1a(buffer_.data() + start + kRecordHeader, payload_size);
+  memcpy(&buffer_[start + sizeof(uint32_t)], &checksum, sizeof(checksum));
+
+  const auto now = chrono::steady_clock::now();
+  if (pending_++ == 0) {
+    oldest_pending_ = now;
+  }
+  if (pending_ >= policy_.max_records ||
+      now - oldest_pending_ >= policy_.max_delay) {
+    Sync();
+  }
+}
+
+void WriteAheadLog::Sync() {
+  if (pending_ == 0) {
+    return;
+  }
+  for (size_t written = 0; written < buffer_.size();) {
+    const ssize_t result =
+        write(fd_, buffer_.data() + written, buffer_.size() - written);
+    if (result < 0 && errno != EINTR) {
+      Fail("Can't write", path_);
+    }
+    written += max<ssize_t>(result, 0);
+  }
+  if (fdatasync(fd_) != 0) {
+    Fail("Can't sync", path_);
+  }
+  buffer_.clear();
+  pending_ = 0;
+  ++sync_count_;
+}
+
+void WriteAheadLog::Reset() {
+  buffer_.clear();
+  pending_ = 0;
+  size_ = 0;
+  if (ftruncate(fd_, 0) != 0 || fdatasync(fd_) != 0) {
+    Fail("Can't truncate", path_);
+  }
+}
+
+void WriteAheadLog::Rotate() {
+  Sync();
+  const string rotated = RotatedPath(path_);
+  if (access(rotated.c_str(), F_OK) == 0) {
+    // A compaction that never finished left older records there, and no
+    // snapshot holds them yet: this log's records go after them instead of
+    // replacing them. Until the log is emptied both files hold these
+    // records, and recovery skips the second copy by position.
+    AppendToRotated(rotated);
+    Reset();
+    return;
+  }
+  if (rename(path_.c_str(), rotated.c_str()) != 0) {
+    Fail("Can't rename", path_);
+  }
+  const int fd =
+      open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) {
+    Fail("Can't open", path_);
+  }
+  close(fd_);
+  fd_ = fd;
+  size_ = 0;
+  // Both the rename and the new log, before records go to it.
+  SyncDirectory(path_);
+}
+
+void WriteAheadLog::AppendToRotated(const string &rotated) {
+  // Records after a torn one would never be read.
+  const uint64_t valid_size = ReadLog(rotated, [](const LogRecord &) {});
+  const string records = ReadLogFile(path_);
+  const int fd = open(rotated.c_str(), O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    Fail("Can't open", rotated);
+  }
+  bool written = ftruncate(fd, valid_size) == 0;
+  for (size_t done = 0; written && done < records.size();) {
+    const ssize_t result =
+        write(fd, records.data() + done, records.size() - done);
+    written = result >= 0 || errno == EINTR;
+    done += max<ssize_t>(result, 0);
+  }
+  written = written && fdatasync(fd) == 0;
+  close(fd);
+  if (!written) {
+    Fail("Can't append to", rotated);
+  }
+}
+
+size_t DecodeLogRecord(string_view data, LogRecord &record) {
+  if (data.size() < kRecordHeader) {
+    return 0;
+  }
+  const uint32_t payload_size = Get<uint32_t>(data.data());
+  if (payload_size < kPayloadHeader ||
+      payload_size > data.size() - kRecordHeader) {
+    return 0;
+  }
+  const char *payload = data.data() + kRecordHeader;
+  if (Fnv1a(payload, payload_size) !=
+      Get<uint64_t>(data.data() + sizeof(uint32_t))) {
+    return 0;
+  }
+  const uint8_t op = Get<uint8_t>(payload + sizeof(uint64_t));
+  if (op < static_cast<uint8_t>(LogOp::Add) ||
+      op > static_cast<uint8_t>(LogOp::DeleteEvent)) {
+    return 0;
+  }
+  record.position = Get<uint64_t>(payload);
+  record.op = static_cast<LogOp>(op);
+  record.date = Date::FromKey(Get<int32_t>(payload + sizeof(uint64_t) + 1));
+  record.text = string_view(payload + kPayloadHeader,
+                            payload_size - kPayloadHeader);
+  return kRecordHeader + payload_size;
+}
+
+string ReadLogFile(const string &path) {
+  ifstream in(path, ios::binary);
+  if (!in) {
+    return {};
+  }
+  ostringstream data;
+  data << in.rdbuf();
+  return data.str();
+}
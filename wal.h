@@ -0,0 +1,98 @@
+#pragma once
+#include "date.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum class LogOp : uint8_t { Add = 1, Del, DeleteDate, DeleteEvent };
+
+// One mutation. `text` is the event for Add and DeleteEvent and the
+// condition for Del; `position` numbers the records of a database from 1.
+struct LogRecord {
+  uint64_t position;
+  LogOp op;
+  Date date;
+  std::string_view text;
+};
+
+// When appended records are forced to disk. Records are checked on Append,
+// so an idle log keeps its last records until the next Append or Sync.
+struct GroupCommitPolicy {
+  size_t max_records = 1024;
+  std::chrono::milliseconds max_delay{10};
+};
+
+// Append-only file of LogRecords. Each record is stored as its payload
+// size, a checksum and the payload, so a torn tail is recognized and
+// dropped on recovery. Appends are buffered and written with one fdatasync
+// per group.
+class WriteAheadLog {
+public:
+  // Opens or creates the log and cuts it to the `valid_size` bytes that
+  // ReadLog accepted.
+  WriteAheadLog(const std::string &path, uint64_t valid_size,
+                GroupCommitPolicy policy = {});
+  ~WriteAheadLog();
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  void Append(const LogRecord &record);
+  // Writes and syncs every buffered record.
+  void Sync();
+  // Empties the log once a snapshot holds all of it.
+  void Reset();
+  // Syncs the log, renames it to RotatedPath and carries on in a new,
+  // empty file. The rotated records are replayed before the log's own
+  // until a snapshot holds them and the file is removed. A rotated file
+  // still there gets the records appended rather than replaced.
+  void Rotate();
+
+  const std::string &GetPath() const { return path_; }
+  // Bytes in the log, buffered records included.
+  uint64_t GetSize() const { return size_; }
+  uint64_t GetSyncCount() const { return sync_count_; }
+
+  // Where the snapshot holding the log's oldest records is kept.
+  static std::string CheckpointPath(const std::string &path) {
+    return path + ".snapshot";
+  }
+  static std::string RotatedPath(const std::string &path) {
+    return path + ".old";
+  }
+
+private:
+  void AppendToRotated(const std::string &rotated);
+
+  std::string path_;
+  int fd_;
+  GroupCommitPolicy policy_;
+  std::string buffer_;
+  uint64_t size_;
+  size_t pending_ = 0;
+  std::chrono::steady_clock::time_point oldest_pending_;
+  uint64_t sync_count_ = 0;
+};
+
+// Calls visitor(const LogRecord &) for every intact record of the log at
+// `path`, stopping at the first torn or corrupt one. Returns the size of
+// the intact prefix; a missing log is empty.
+template <typename Visitor>
+uint64_t ReadLog(const std::string &path, Visitor visitor);
+
+// Decodes the record at the start of `data`, returning its stored size or
+// 0 if it is incomplete or corrupt.
+size_t DecodeLogRecord(std::string_view data, LogRecord &record);
+std::string ReadLogFile(const std::string &path);
+
+template <typename Visitor>
+uint64_t ReadLog(const std::string &path, Visitor visitor) {
+  const std::string data = ReadLogFile(path);
+  std::string_view rest = data;
+  LogRecord record;
+  while (const size_t size = DecodeLogRecord(rest, record)) {
+    visitor(record);
+    rest.remove_prefix(size);
+  }
+  return data.size() - rest.size();
+}